@@ -0,0 +1,144 @@
+/*
+ * Hardware Performance Counters
+ *
+ * Copyright (C) 2019 Tom Tsou <tom@tsou.cc>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <cstring>
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "PerfCounters.h"
+
+using namespace std;
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#define CACHE_READ_MISS(C) \
+    ((C) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+/*
+ * Events with a group are opened as members of the named earlier event, and
+ * are reset, enabled and disabled with it
+ */
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+    const char *group;
+} event_table[] = {
+    { "cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, nullptr },
+    { "instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "cycles" },
+    { "l1d_misses",    PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D), nullptr },
+    { "llc_misses",    PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL), nullptr },
+    { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, nullptr },
+    { "task_clock",    PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, nullptr },
+};
+
+static int open_event(uint32_t type, uint64_t config, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group_fd < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+PerfCounters::PerfCounters()
+{
+    for (auto &e:event_table) {
+        int group_fd = -1;
+        for (auto &g:events)
+            if (e.group && g.name == e.group) group_fd = g.fd;
+
+        /* Count on its own if the group could not be formed */
+        int fd = group_fd >= 0 ? open_event(e.type, e.config, group_fd) : -1;
+        bool leader = fd < 0;
+        if (fd < 0) fd = open_event(e.type, e.config, -1);
+        events.push_back(Counter { e.name, fd, leader, true, 0.0 });
+    }
+}
+
+/* Group leaders carry their members */
+#define GROUP_IOCTL(E, REQ) \
+    if ((E).fd >= 0 && (E).leader) ioctl((E).fd, (REQ), PERF_IOC_FLAG_GROUP)
+
+void PerfCounters::start()
+{
+    for (auto &e:events) GROUP_IOCTL(e, PERF_EVENT_IOC_RESET);
+    for (auto &e:events) GROUP_IOCTL(e, PERF_EVENT_IOC_ENABLE);
+}
+
+/*
+ * Add the count of the last interval, scaled by the time the event was
+ * enabled over the time it was actually counting
+ */
+void PerfCounters::stop()
+{
+    for (auto &e:events) GROUP_IOCTL(e, PERF_EVENT_IOC_DISABLE);
+    for (auto &e:events) {
+        if (e.fd < 0) continue;
+        uint64_t data[3];
+        if (::read(e.fd, data, sizeof(data)) != sizeof(data)) continue;
+        uint64_t count = data[0], enabled = data[1], running = data[2];
+        if (!running) {
+            if (enabled) e.scheduled = false;
+            continue;
+        }
+        e.value += running < enabled ? (double) count * enabled / running : count;
+    }
+}
+#else
+PerfCounters::PerfCounters() { }
+void PerfCounters::start() { }
+void PerfCounters::stop() { }
+#endif
+
+PerfCounters::~PerfCounters()
+{
+    for (auto &e:events)
+        if (e.fd >= 0) close(e.fd);
+}
+
+bool PerfCounters::available(const string &name) const
+{
+    for (auto &e:events)
+        if (e.name == name) return e.fd >= 0 && e.scheduled;
+    return false;
+}
+
+double PerfCounters::value(const string &name) const
+{
+    for (auto &e:events)
+        if (e.name == name) return e.value;
+    return 0.0;
+}
+
+void PerfCounters::reset()
+{
+    for (auto &e:events) {
+        e.value = 0.0;
+        e.scheduled = true;
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef _PERFCOUNTERS_H_
+#define _PERFCOUNTERS_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*
+ * Per thread Linux perf_event counters for user space execution. Each event
+ * is opened on its own, so that events the CPU, kernel or virtual machine
+ * does not provide are reported as unavailable without losing the others.
+ * Instructions are grouped with cycles so that both are counted over the same
+ * intervals. When the kernel multiplexes more events than the PMU holds,
+ * counts are scaled up by the fraction of time each event was scheduled, and
+ * an event that was never scheduled is reported as unavailable.
+ */
+class PerfCounters {
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    void start();
+    void stop();
+
+    struct Counter {
+        std::string name;
+        int fd;
+        bool leader;
+        bool scheduled;
+        double value;
+    };
+
+    /* Counts accumulated over start() and stop() pairs since start of use */
+    const std::vector<Counter> &counters() const { return events; }
+    bool available(const std::string &name) const;
+    double value(const std::string &name) const;
+    void reset();
+
+private:
+    std::vector<Counter> events;
+};
+
+#endif /* _PERFCOUNTERS_H_ */
@@ -0,0 +1,83 @@
+/*
+ * Multichannel Resampler Benchmark
+ *
+ * Copyright (C) 2019 Tom Tsou <tom@tsou.cc>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <complex>
+#include <vector>
+
+#include "Resampler.h"
+
+using namespace std;
+using namespace std::chrono;
+
+static const unsigned P = 3, Q = 2;
+static const size_t block_sz = 4096 / Q * Q;
+static const size_t total_sz = 1 << 20;
+static vector<unsigned> channel_counts { 1, 2, 4, 8, 16, 32, 64 };
+
+/*
+ * Nanoseconds per channel output sample for 'total_sz' input samples per
+ * channel, processed in blocks of 'block_sz'
+ */
+static double bench_separate(unsigned N)
+{
+    vector<ComplexResampler<float>> resamplers;
+    for (unsigned c = 0; c < N; c++)
+        resamplers.emplace_back(P, Q);
+    vector<complex<float>> input(block_sz, complex<float>(0.5f, -0.5f));
+    vector<complex<float>> output(block_sz * P / Q);
+
+    auto start = steady_clock::now();
+    for (size_t n = 0; n < total_sz; n += block_sz)
+        for (auto &r:resamplers)
+            r.resample(input, output);
+    duration<double, nano> elapsed = steady_clock::now() - start;
+    return elapsed.count() / (total_sz * P / Q * N);
+}
+
+static double bench_multi(unsigned N)
+{
+    MultiResampler<float> resampler(P, Q, N);
+    vector<complex<float>> input(block_sz * N, complex<float>(0.5f, -0.5f));
+    vector<complex<float>> output(block_sz * P / Q * N);
+
+    auto start = steady_clock::now();
+    for (size_t n = 0; n < total_sz; n += block_sz)
+        resampler.resample(input, output);
+    duration<double, nano> elapsed = steady_clock::now() - start;
+    return elapsed.count() / (total_sz * P / Q * N);
+}
+
+int main(int argc, char **argv)
+{
+    cout << "Multichannel fc32 resampler, ratio " << P << "/" << Q
+         << ", ns per channel output sample" << endl << endl;
+    cout << setw(10) << "Channels" << setw(12) << "Separate"
+         << setw(12) << "Multi" << setw(10) << "Speedup" << endl;
+
+    for (auto N:channel_counts) {
+        double separate = bench_separate(N);
+        double multi = bench_multi(N);
+        cout << fixed << setprecision(2)
+             << setw(10) << N << setw(12) << separate
+             << setw(12) << multi << setw(10) << separate / multi << endl;
+    }
+}
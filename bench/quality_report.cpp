@@ -0,0 +1,298 @@
+/*
+ * Resampler Quality and Throughput Report
+ *
+ * Copyright (C) 2019 Tom Tsou <tom@tsou.cc>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <getopt.h>
+#include <iostream>
+#include <chrono>
+#include <complex>
+#include <vector>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include "Resampler.h"
+
+using namespace std;
+using namespace std::chrono;
+
+/*
+ * Tone test length in input samples and resampler call size
+ */
+#define TONE_LEN        (1 << 16)
+#define BLOCK_LEN       4096
+
+/*
+ * Zero padding factor of the prototype filter response
+ */
+#define FFT_OVERSAMPLE  8
+
+struct report_args {
+    double pass = 0.8;
+    unsigned p = 0, q = 0, taps = 0;
+};
+
+static vector<pair<unsigned, unsigned>> ratios {
+    { 3, 2 }, { 2, 3 }, { 4, 1 }, { 1, 4 }, { 147, 160 }, { 160, 147 },
+};
+static vector<unsigned> tap_counts { 32, 64, 128, 256, 384 };
+
+static void fft(vector<complex<double>> &x)
+{
+    size_t n = x.size();
+    for (size_t i = 1, j = 0; i < n; i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) swap(x[i], x[j]);
+    }
+    for (size_t len = 2; len <= n; len <<= 1) {
+        complex<double> w = polar(1.0, -2 * M_PI / len);
+        for (size_t i = 0; i < n; i += len) {
+            complex<double> wk = 1.0;
+            for (size_t k = 0; k < len / 2; k++, wk *= w) {
+                auto a = x[i + k], b = x[i + k + len / 2] * wk;
+                x[i + k] = a + b;
+                x[i + k + len / 2] = a - b;
+            }
+        }
+    }
+}
+
+/*
+ * Passband ripple and stopband attenuation in dB of the prototype filter
+ * reassembled from a filterbank. The filter runs at P times the input rate
+ * with cutoff 'fc' at the lower of the input and output Nyquist rates. The
+ * passband spans 'pass' of the cutoff and the stopband starts at (2 - pass)
+ * of the cutoff, from where aliases fold onto frequencies above the passband.
+ */
+template <typename C>
+static void response(const vector<vector<C>> &bank, unsigned Q, double pass,
+                     double &ripple, double &atten)
+{
+    size_t P = bank.size(), taps = bank[0].size(), n = 1;
+    while (n < P * taps * FFT_OVERSAMPLE) n <<= 1;
+
+    vector<complex<double>> h(n);
+    for (size_t p = 0; p < P; p++)
+        for (size_t j = 0; j < taps; j++)
+            h[j * P + p] = bank[p][taps - 1 - j];
+    fft(h);
+
+    double dc = abs(h[0]), fc = 0.5 / max<size_t>(P, Q);
+    double lo = numeric_limits<double>::max(), hi = -lo, stop = -lo;
+    for (size_t i = 0; i <= n / 2; i++) {
+        double f = (double) i / n;
+        double db = 20 * log10(max(abs(h[i]) / dc, 1e-300));
+        if (f <= pass * fc) {
+            lo = min(lo, db);
+            hi = max(hi, db);
+        } else if (f >= (2 - pass) * fc) {
+            stop = max(stop, db);
+        }
+    }
+    ripple = hi - lo;
+    atten = -stop;
+}
+
+template <typename T>
+static double scale()
+{
+    return is_integral<T>::value ? numeric_limits<T>::max() / 2 : 0.5;
+}
+
+/*
+ * Tone generation and single tone least squares fit. The fit returns the
+ * power of the fitted tone and of the residual, which holds images, aliases,
+ * leakage and arithmetic error.
+ */
+template <typename T>
+static void tone(vector<T> &x, double w)
+{
+    for (size_t i = 0; i < x.size(); i++)
+        x[i] = scale<T>() * cos(w * i);
+}
+
+template <typename T>
+static void tone(vector<complex<T>> &x, double w)
+{
+    for (size_t i = 0; i < x.size(); i++)
+        x[i] = complex<T>(scale<T>() * cos(w * i), scale<T>() * sin(w * i));
+}
+
+template <typename T>
+static void fit(const vector<T> &y, double w, size_t skip, double &sig, double &err)
+{
+    double cc = 0, ss = 0, cs = 0, yc = 0, ys = 0;
+    for (size_t i = skip; i < y.size(); i++) {
+        double c = cos(w * i), s = sin(w * i);
+        cc += c * c, ss += s * s, cs += c * s;
+        yc += y[i] * c, ys += y[i] * s;
+    }
+    double det = cc * ss - cs * cs;
+    double a = (yc * ss - ys * cs) / det, b = (ys * cc - yc * cs) / det;
+
+    sig = err = 0.0;
+    for (size_t i = skip; i < y.size(); i++) {
+        double t = a * cos(w * i) + b * sin(w * i);
+        sig += t * t;
+        err += (y[i] - t) * (y[i] - t);
+    }
+}
+
+template <typename T>
+static void fit(const vector<complex<T>> &y, double w, size_t skip, double &sig, double &err)
+{
+    complex<double> a = 0.0;
+    for (size_t i = skip; i < y.size(); i++)
+        a += complex<double>(y[i].real(), y[i].imag()) * polar(1.0, -w * i);
+    a /= y.size() - skip;
+
+    sig = err = 0.0;
+    for (size_t i = skip; i < y.size(); i++) {
+        auto t = a * polar(1.0, w * i);
+        sig += norm(t);
+        err += norm(complex<double>(y[i].real(), y[i].imag()) - t);
+    }
+}
+
+/*
+ * Resample a tone in the passband, at an irrational fraction of the lower
+ * Nyquist rate, and return the tone to residual ratio in dB and the output
+ * rate in Msps
+ */
+template <typename R, typename S>
+static void measure(unsigned P, unsigned Q, unsigned taps, double pass,
+                    double &snr, double &msps)
+{
+    R resampler(P, Q, taps);
+    size_t blk = max<size_t>(BLOCK_LEN / Q, 1) * Q;
+    size_t n_in = max<size_t>(TONE_LEN / blk, 1) * blk;
+    double w = 2 * M_PI * 0.5 * min(1.0, (double) P / Q) * pass * M_SQRT1_2;
+    vector<S> input(n_in), output(n_in / Q * P);
+    tone(input, w);
+
+    vector<S> in_blk(blk), out_blk(blk / Q * P);
+    auto start = steady_clock::now();
+    for (size_t pos = 0; pos < n_in; pos += blk) {
+        copy(input.begin() + pos, input.begin() + pos + blk, in_blk.begin());
+        resampler.resample(in_blk, out_blk);
+        copy(out_blk.begin(), out_blk.end(), output.begin() + pos / Q * P);
+    }
+    duration<double, micro> elapsed = steady_clock::now() - start;
+    msps = output.size() / elapsed.count();
+
+    double sig, err;
+    fit(output, w * Q / P, 2 * taps * P / Q + 1, sig, err);
+    snr = 10 * log10(sig / max(err, 1e-300));
+}
+
+struct kernel {
+    string name;
+    bool narrow;
+    function<void(unsigned, unsigned, unsigned, double, double &, double &)> measure;
+};
+
+static vector<kernel> kernels {
+    { "fc64", false, measure<ComplexResampler<double>, complex<double>> },
+    { "fc32", false, measure<ComplexResampler<float>, complex<float>> },
+    { "fc32-float", true, measure<ComplexResampler<float, Precision::Float>, complex<float>> },
+    { "sc16", false, measure<ComplexResampler<short>, complex<short>> },
+    { "sc8", false, measure<ComplexResampler<char>, complex<char>> },
+    { "f32", false, measure<RealResampler<float>, float> },
+    { "f32-float", true, measure<RealResampler<float, Precision::Float>, float> },
+    { "s16", false, measure<RealResampler<short>, short> },
+};
+
+static void print_help()
+{
+    fprintf(stdout, "Options:\n"
+            "  -h, --help         This text\n"
+            "  -p, --numerator    Report only rational rate numerator 'P'\n"
+            "  -q, --denominator  Report only rational rate denominator 'Q'\n"
+            "  -n, --taps         Report only 'N' taps per partition\n"
+            "  -b, --passband     Passband as a fraction of the lower Nyquist rate (default=0.8)\n"
+            );
+}
+
+static bool handle_options(int argc, char **argv, report_args &args)
+{
+    int option;
+    static struct option long_options[] = {
+        { "help", 0, 0, 'h' },
+        { "numerator", 1, 0, 'p' },
+        { "denominator", 1, 0, 'q' },
+        { "taps", 1, 0, 'n' },
+        { "passband", 1, 0, 'b' },
+        { 0, 0, 0, 0 },
+    };
+    while ((option = getopt_long(argc, argv, "hp:q:n:b:", long_options, NULL)) != -1) {
+        switch (option) {
+        case 'p':
+                args.p = atoi(optarg);
+                break;
+        case 'q':
+                args.q = atoi(optarg);
+                break;
+        case 'n':
+                args.taps = atoi(optarg);
+                break;
+        case 'b':
+                args.pass = atof(optarg);
+                break;
+        default:
+                print_help();
+                return false;
+        };
+    }
+    if (!(args.pass > 0.0 && args.pass < 1.0) || !args.p != !args.q) {
+        print_help();
+        return false;
+    }
+    if (args.p) ratios = { { args.p, args.q } };
+    if (args.taps) tap_counts = { args.taps };
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    report_args args;
+    if (!handle_options(argc, argv, args)) return -1;
+
+    cout << "p,q,taps,kernel,passband_ripple_db,stopband_atten_db,snr_db,output_msps" << endl;
+    for (auto &ratio:ratios) {
+        unsigned P = ratio.first, Q = ratio.second;
+        for (auto taps:tap_counts) {
+            double ripple[2], atten[2];
+            response(Resampler::design(P, Q, taps, false)->partitions, Q, args.pass,
+                     ripple[0], atten[0]);
+            response(Resampler::design(P, Q, taps, true)->fpartitions, Q, args.pass,
+                     ripple[1], atten[1]);
+
+            for (auto &k:kernels) {
+                double snr, msps;
+                k.measure(P, Q, taps, args.pass, snr, msps);
+                cout << P << "," << Q << "," << taps << "," << k.name << ","
+                     << ripple[k.narrow] << "," << atten[k.narrow] << ","
+                     << snr << "," << msps << endl;
+            }
+        }
+    }
+}
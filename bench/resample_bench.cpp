@@ -0,0 +1,381 @@
+/*
+ * Resampler Throughput Benchmark
+ *
+ * Copyright (C) 2019 Tom Tsou <tom@tsou.cc>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <getopt.h>
+#include <sched.h>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <complex>
+#include <vector>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <map>
+#include <limits>
+#include <cmath>
+
+#include "Resampler.h"
+#include "PerfCounters.h"
+
+using namespace std;
+using namespace std::chrono;
+
+struct bench_args {
+    int cpu = 0;
+    unsigned reps = 5;
+    size_t samples = 1 << 16;
+    string type;
+    bool quick = false;
+    string save, baseline;
+    double tolerance = 15.0;
+};
+
+struct bench_result {
+    string type;
+    unsigned p, q, taps;
+    size_t block;
+    double median, stddev, best;
+
+    /* Counter events per output sample, negative if unavailable */
+    vector<pair<string, double>> counters;
+};
+
+static vector<pair<unsigned, unsigned>> ratios { { 3, 2 }, { 2, 3 }, { 4, 1 }, { 1, 4 }, { 147, 160 } };
+static vector<unsigned> tap_counts { 64, 128, 384 };
+static vector<size_t> block_lens { 1024, 16384 };
+
+/*
+ * Short grid of the regression check, and the number of times a regressed
+ * configuration is measured again before it is reported
+ */
+static vector<pair<unsigned, unsigned>> quick_ratios { { 3, 2 }, { 147, 160 } };
+static vector<unsigned> quick_tap_counts { 128 };
+static vector<size_t> quick_block_lens { 4096 };
+static const unsigned retries = 3;
+
+/*
+ * Test signal at half of full scale for the sample type
+ */
+template <typename T>
+static double scale()
+{
+    return is_integral<T>::value ? numeric_limits<T>::max() / 2 : 0.5;
+}
+
+template <typename T>
+static void fill(vector<T> &x)
+{
+    for (size_t i = 0; i < x.size(); i++)
+        x[i] = scale<T>() * sin(0.01 * i);
+}
+
+template <typename T>
+static void fill(vector<complex<T>> &x)
+{
+    for (size_t i = 0; i < x.size(); i++)
+        x[i] = complex<T>(scale<T>() * cos(0.01 * i), scale<T>() * sin(0.01 * i));
+}
+
+/*
+ * Output nanoseconds per sample over 'reps' timed runs after one untimed
+ * warm-up run. Each run resamples about 'samples' inputs in blocks of
+ * 'block_len'. Performance counters cover the timed runs only.
+ */
+template <typename R, typename S>
+static bench_result bench(const bench_args &args, PerfCounters &perf, unsigned P,
+                          unsigned Q, unsigned taps, size_t block_len)
+{
+    R resampler(P, Q, taps);
+    size_t len = max<size_t>(block_len / Q, 1) * Q;
+    size_t n_blks = max<size_t>(args.samples / len, 1);
+    vector<S> input(len), output(len / Q * P);
+    fill(input);
+
+    vector<double> ns;
+    perf.reset();
+    for (unsigned rep = 0; rep <= args.reps; rep++) {
+        if (rep) perf.start();
+        auto start = steady_clock::now();
+        for (size_t n = 0; n < n_blks; n++)
+            resampler.resample(input, output);
+        duration<double, nano> elapsed = steady_clock::now() - start;
+        if (rep) perf.stop();
+        if (rep) ns.push_back(elapsed.count() / (n_blks * output.size()));
+    }
+
+    bench_result r;
+    r.p = P, r.q = Q, r.taps = taps, r.block = block_len;
+    double outputs = (double) args.reps * n_blks * output.size();
+    for (auto &c:perf.counters())
+        r.counters.emplace_back(c.name, perf.available(c.name) ? c.value / outputs : -1.0);
+    r.counters.emplace_back("ipc", perf.available("cycles") && perf.available("instructions") ?
+                            perf.value("instructions") / perf.value("cycles") : -1.0);
+
+    double mean = 0.0, var = 0.0;
+    for (auto v:ns) mean += v / ns.size();
+    for (auto v:ns) var += (v - mean) * (v - mean) / ns.size();
+    sort(ns.begin(), ns.end());
+    r.median = ns.size() % 2 ? ns[ns.size() / 2] :
+               (ns[ns.size() / 2 - 1] + ns[ns.size() / 2]) / 2;
+    r.stddev = sqrt(var);
+    r.best = ns[0];
+    return r;
+}
+
+typedef function<bench_result(const bench_args &, PerfCounters &,
+                              unsigned, unsigned, unsigned, size_t)> bench_fn;
+
+static vector<pair<string, bench_fn>> types {
+    { "fc64", bench<ComplexResampler<double>, complex<double>> },
+    { "fc32", bench<ComplexResampler<float>, complex<float>> },
+    { "sc64", bench<ComplexResampler<long>, complex<long>> },
+    { "sc32", bench<ComplexResampler<int>, complex<int>> },
+    { "sc16", bench<ComplexResampler<short>, complex<short>> },
+    {  "sc8", bench<ComplexResampler<char>, complex<char>> },
+    {  "f64", bench<RealResampler<double>, double> },
+    {  "f32", bench<RealResampler<float>, float> },
+    {  "s64", bench<RealResampler<long>, long> },
+    {  "s32", bench<RealResampler<int>, int> },
+    {  "s16", bench<RealResampler<short>, short> },
+    {   "s8", bench<RealResampler<char>, char> },
+};
+
+static void print_help()
+{
+    fprintf(stdout, "Options:\n"
+            "  -h, --help         This text\n"
+            "  -c, --cpu          Pin to CPU 'N', or -1 for no pinning (default=0)\n"
+            "  -r, --reps         Timed repetitions per configuration (default=5)\n"
+            "  -n, --samples      Input samples per repetition (default=65536)\n"
+            "  -t, --sampletype   Benchmark only this sample type\n"
+            "  -k, --quick        Run the short grid of the regression check\n"
+            "  -s, --save         Write minimum times to a baseline file\n"
+            "  -B, --baseline     Compare minimum times with a baseline file\n"
+            "  -T, --tolerance    Slowdown in percent counted as a regression (default=15)\n"
+            );
+}
+
+static bool handle_options(int argc, char **argv, bench_args &args)
+{
+    int option;
+    static struct option long_options[] = {
+        { "help", 0, 0, 'h' },
+        { "cpu", 1, 0, 'c' },
+        { "reps", 1, 0, 'r' },
+        { "samples", 1, 0, 'n' },
+        { "sampletype", 1, 0, 't' },
+        { "quick", 0, 0, 'k' },
+        { "save", 1, 0, 's' },
+        { "baseline", 1, 0, 'B' },
+        { "tolerance", 1, 0, 'T' },
+        { 0, 0, 0, 0 },
+    };
+    while ((option = getopt_long(argc, argv, "hc:r:n:t:ks:B:T:", long_options, NULL)) != -1) {
+        switch (option) {
+        case 'c':
+                args.cpu = atoi(optarg);
+                break;
+        case 'r':
+                args.reps = atoi(optarg);
+                break;
+        case 'n':
+                args.samples = atol(optarg);
+                break;
+        case 't':
+                args.type = string(optarg);
+                break;
+        case 'k':
+                args.quick = true;
+                break;
+        case 's':
+                args.save = string(optarg);
+                break;
+        case 'B':
+                args.baseline = string(optarg);
+                break;
+        case 'T':
+                args.tolerance = atof(optarg);
+                break;
+        default:
+                print_help();
+                return false;
+        };
+    }
+    if (!args.reps || !args.samples || !(args.tolerance >= 0.0)) {
+        print_help();
+        return false;
+    }
+    if (args.quick) {
+        ratios = quick_ratios;
+        tap_counts = quick_tap_counts;
+        block_lens = quick_block_lens;
+    }
+    return true;
+}
+
+/*
+ * Pin to one CPU so that runs do not migrate between cores with different
+ * cache state or clock
+ */
+static bool pin(int cpu)
+{
+    if (cpu < 0) return true;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return !sched_setaffinity(0, sizeof(set), &set);
+}
+
+static string config(const bench_result &r)
+{
+    ostringstream ss;
+    ss << r.type << " " << r.p << " " << r.q << " " << r.taps << " " << r.block;
+    return ss.str();
+}
+
+static bool save(const string &path, const vector<bench_result> &results)
+{
+    ofstream file(path);
+    file << "# type p q taps block min_ns_per_output" << endl;
+    for (auto &r:results)
+        file << config(r) << " " << r.best << endl;
+    return (bool) file;
+}
+
+/*
+ * Compare the fastest repetition with a baseline written by --save on the
+ * same host class. The minimum is used rather than the median as it is least
+ * affected by other load on the machine. A configuration regresses when it is
+ * slower than its baseline by more than 'tolerance' percent in each of
+ * 'retries' further measurements with 'remeasure'. Configurations absent from
+ * the baseline are reported and skipped.
+ */
+static bool compare(const string &path, double tolerance, const vector<bench_result> &results,
+                    const function<double(size_t)> &remeasure)
+{
+    ifstream file(path);
+    if (!file) {
+        cerr << "Failed to open baseline " << path << endl;
+        return false;
+    }
+
+    map<string, double> baseline;
+    string line;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        bench_result r;
+        double ns;
+        istringstream ss(line);
+        if (!(ss >> r.type >> r.p >> r.q >> r.taps >> r.block >> ns)) {
+            cerr << "Invalid baseline line: " << line << endl;
+            return false;
+        }
+        baseline[config(r)] = ns;
+    }
+
+    int regressions = 0, compared = 0;
+    cerr << fixed << setprecision(3);
+    for (size_t i = 0; i < results.size(); i++) {
+        auto b = baseline.find(config(results[i]));
+        cerr << "  " << left << setw(24) << config(results[i]) << right;
+        if (b == baseline.end()) {
+            cerr << "  no baseline" << endl;
+            continue;
+        }
+        double best = results[i].best;
+        for (unsigned n = 0; n < retries && best > b->second * (1.0 + tolerance / 100.0); n++)
+            best = min(best, remeasure(i));
+        double change = 100.0 * (best / b->second - 1.0);
+        bool regressed = change > tolerance;
+        cerr << setw(9) << best << " ns" << setw(9) << b->second << " ns"
+             << setw(10) << showpos << change << noshowpos << "%"
+             << (regressed ? "  REGRESSION" : "") << endl;
+        regressions += regressed;
+        compared++;
+    }
+    cerr << defaultfloat << "Compared " << compared << " configurations with " << path << ": "
+         << regressions << " slower by more than " << tolerance << "%" << endl;
+    return !regressions;
+}
+
+int main(int argc, char **argv)
+{
+    bench_args args;
+    if (!handle_options(argc, argv, args)) return -1;
+    if (!pin(args.cpu)) {
+        cerr << "Failed to pin to CPU " << args.cpu << endl;
+        return -1;
+    }
+
+    cout << "{" << endl;
+    cout << "  \"benchmark\": \"resample\"," << endl;
+    cout << "  \"cpu\": " << args.cpu << "," << endl;
+    cout << "  \"repetitions\": " << args.reps << "," << endl;
+    cout << "  \"samples\": " << args.samples << "," << endl;
+    cout << "  \"results\": [";
+
+    PerfCounters perf;
+    vector<bench_result> results;
+    vector<function<bench_result()>> runs;
+    const char *sep = "\n";
+    for (auto &t:types) {
+        if (!args.type.empty() && t.first != args.type) continue;
+        for (auto &ratio:ratios) {
+            for (auto taps:tap_counts) {
+                for (auto len:block_lens) {
+                    auto fn = t.second;
+                    unsigned P = ratio.first, Q = ratio.second;
+                    runs.push_back([&args, &perf, fn, P, Q, taps, len] {
+                        return fn(args, perf, P, Q, taps, len);
+                    });
+                    auto r = runs.back()();
+                    r.type = t.first;
+                    results.push_back(r);
+                    cout << sep << "    { \"type\": \"" << t.first << "\""
+                         << ", \"p\": " << ratio.first << ", \"q\": " << ratio.second
+                         << ", \"taps\": " << taps << ", \"block\": " << len
+                         << ", \"ns_per_output\": { \"median\": " << r.median
+                         << ", \"stddev\": " << r.stddev << ", \"min\": " << r.best << " }"
+                         << ", \"output_msps\": " << 1e3 / r.median
+                         << ", \"per_output\": {";
+                    for (size_t i = 0; i < r.counters.size(); i++) {
+                        cout << (i ? ", \"" : " \"") << r.counters[i].first << "\": ";
+                        if (r.counters[i].second < 0.0) cout << "null";
+                        else cout << r.counters[i].second;
+                    }
+                    cout << " } }";
+                    sep = ",\n";
+                }
+            }
+        }
+    }
+    cout << endl << "  ]" << endl << "}" << endl;
+
+    if (!args.save.empty() && !save(args.save, results)) {
+        cerr << "Failed to write baseline " << args.save << endl;
+        return -1;
+    }
+    if (!args.baseline.empty() && !compare(args.baseline, args.tolerance, results,
+                                             [&](size_t i) { return runs[i]().best; }))
+        return 1;
+}
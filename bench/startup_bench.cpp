@@ -0,0 +1,108 @@
+/*
+ * Resampler Construction and First Call Benchmark
+ *
+ * Copyright (C) 2019 Tom Tsou <tom@tsou.cc>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <chrono>
+#include <complex>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "Resampler.h"
+
+using namespace std;
+using namespace std::chrono;
+
+static const unsigned reps = 9;
+static const size_t block_len = 4096;
+static vector<pair<unsigned, unsigned>> ratios {
+    { 3, 2 }, { 2, 3 }, { 4, 1 }, { 147, 160 }, { 160, 147 }, { 441, 480 }, { 1001, 1000 },
+};
+static vector<unsigned> tap_counts { 64, 128, 384, 1024 };
+
+static double median(vector<double> v)
+{
+    sort(v.begin(), v.end());
+    return v.size() % 2 ? v[v.size() / 2] : (v[v.size() / 2 - 1] + v[v.size() / 2]) / 2;
+}
+
+template <typename D>
+static double usec(D d)
+{
+    return duration<double, micro>(d).count();
+}
+
+/*
+ * Microseconds for construction with the filterbank designed from scratch
+ * (cold) and taken from the library cache while another resampler holds it
+ * (warm), and for the first and second calls on a block of 'block_len'
+ * input samples. The first call extends the path table beyond its initial
+ * length.
+ */
+static void bench(unsigned P, unsigned Q, unsigned taps, vector<double> &t)
+{
+    typedef ComplexResampler<float> R;
+    vector<double> cold, warm, first, second;
+    size_t len = max<size_t>(block_len / Q, 1) * Q;
+    vector<complex<float>> input(len, complex<float>(0.5f, -0.5f)), output(len / Q * P);
+
+    for (unsigned rep = 0; rep < reps; rep++) {
+        auto t0 = steady_clock::now();
+        unique_ptr<R> r(new R(P, Q, taps));
+        auto t1 = steady_clock::now();
+        r->resample(input, output);
+        auto t2 = steady_clock::now();
+        r->resample(input, output);
+        auto t3 = steady_clock::now();
+        unique_ptr<R> w(new R(P, Q, taps));
+        auto t4 = steady_clock::now();
+
+        cold.push_back(usec(t1 - t0));
+        first.push_back(usec(t2 - t1));
+        second.push_back(usec(t3 - t2));
+        warm.push_back(usec(t4 - t3));
+    }
+    t = { median(cold), median(warm), median(first), median(second) };
+}
+
+int main(int argc, char **argv)
+{
+    cout << "{" << endl;
+    cout << "  \"benchmark\": \"startup\"," << endl;
+    cout << "  \"type\": \"fc32\"," << endl;
+    cout << "  \"repetitions\": " << reps << "," << endl;
+    cout << "  \"block\": " << block_len << "," << endl;
+    cout << "  \"results\": [";
+
+    const char *sep = "\n";
+    for (auto &ratio:ratios) {
+        for (auto taps:tap_counts) {
+            vector<double> t;
+            bench(ratio.first, ratio.second, taps, t);
+            cout << sep << "    { \"p\": " << ratio.first << ", \"q\": " << ratio.second
+                 << ", \"taps\": " << taps
+                 << ", \"construct_cold_us\": " << t[0]
+                 << ", \"construct_warm_us\": " << t[1]
+                 << ", \"first_call_us\": " << t[2]
+                 << ", \"second_call_us\": " << t[3] << " }";
+            sep = ",\n";
+        }
+    }
+    cout << endl << "  ]" << endl << "}" << endl;
+}
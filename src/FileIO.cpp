@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2019 Tom Tsou <tom@tsou.cc>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "FileIO.h"
+
+/*
+ * Requested pipe buffer size. Limited by /proc/sys/fs/pipe-max-size for
+ * unprivileged processes, in which case the default size is kept.
+ */
+#define PIPESIZE    (1 << 20)
+
+using namespace std;
+
+StreamSource::StreamSource(const string &path)
+    : istr(path, ifstream::binary)
+{
+    if (istr.fail())
+        throw runtime_error("Failed to open input file " + path);
+}
+
+size_t StreamSource::read(void *buf, size_t len)
+{
+    istr.read((char *) buf, len);
+    return istr.gcount();
+}
+
+StreamSink::StreamSink(const string &path)
+    : ostr(path, ios::out | ios::binary), path(path)
+{
+    if (ostr.fail())
+        throw runtime_error("Failed to open output file " + path);
+}
+
+void StreamSink::write(const void *buf, size_t len)
+{
+    ostr.write((const char *) buf, len);
+    if (ostr.fail())
+        throw runtime_error("Failed to write output file " + path);
+}
+
+void StreamSink::finish()
+{
+    ostr.close();
+    if (ostr.fail())
+        throw runtime_error("Failed to write output file " + path);
+}
+
+static void grow_pipe(int fd)
+{
+#ifdef F_SETPIPE_SZ
+    struct stat st;
+    if (!fstat(fd, &st) && S_ISFIFO(st.st_mode))
+        fcntl(fd, F_SETPIPE_SZ, PIPESIZE);
+#endif
+}
+
+FdSource::FdSource(int fd)
+    : fd(fd)
+{
+    grow_pipe(fd);
+}
+
+size_t FdSource::read(void *buf, size_t len)
+{
+    size_t n = 0;
+    while (n < len) {
+        ssize_t k = ::read(fd, (char *) buf + n, len - n);
+        if (k < 0 && errno == EINTR) continue;
+        if (k < 0)
+            throw runtime_error(string("Failed to read input: ") + strerror(errno));
+        if (!k) break;
+        n += k;
+    }
+    return n;
+}
+
+FdSink::FdSink(int fd)
+    : fd(fd)
+{
+    grow_pipe(fd);
+}
+
+void FdSink::write(const void *buf, size_t len)
+{
+    size_t n = 0;
+    while (n < len) {
+        ssize_t k = ::write(fd, (const char *) buf + n, len - n);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0)
+            throw runtime_error(string("Failed to write output: ") + strerror(errno));
+        n += k;
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef _FILEIO_H_
+#define _FILEIO_H_
+
+#include <string>
+#include <memory>
+#include <fstream>
+
+/*
+ * Sequential byte source and sink for the streaming pipeline. Sources return
+ * fewer bytes than requested only at the end of input. Errors are reported by
+ * exception.
+ */
+class Source {
+public:
+    virtual ~Source() { }
+    virtual size_t read(void *buf, size_t len) = 0;
+};
+
+class Sink {
+public:
+    virtual ~Sink() { }
+    virtual void write(const void *buf, size_t len) = 0;
+
+    /* Flush and close, reporting any deferred write error */
+    virtual void finish() = 0;
+};
+
+/* Buffered iostream backend */
+class StreamSource : public Source {
+public:
+    StreamSource(const std::string &path);
+    size_t read(void *buf, size_t len) override;
+private:
+    std::ifstream istr;
+};
+
+class StreamSink : public Sink {
+public:
+    StreamSink(const std::string &path);
+    void write(const void *buf, size_t len) override;
+    void finish() override;
+private:
+    std::ofstream ostr;
+    std::string path;
+};
+
+/*
+ * Descriptor backend for pipes and terminals. Short reads and writes are
+ * continued, so a block is returned partially only at end of input. Pipe
+ * buffers are enlarged where permitted.
+ */
+class FdSource : public Source {
+public:
+    FdSource(int fd);
+    size_t read(void *buf, size_t len) override;
+private:
+    int fd;
+};
+
+class FdSink : public Sink {
+public:
+    FdSink(int fd);
+    void write(const void *buf, size_t len) override;
+    void finish() override { }
+private:
+    int fd;
+};
+
+/*
+ * Asynchronous io_uring backend with aligned buffers and direct I/O where the
+ * filesystem supports it. Returns NULL if io_uring is unavailable.
+ */
+std::unique_ptr<Source> uring_source(const std::string &path);
+std::unique_ptr<Sink> uring_sink(const std::string &path);
+
+/*
+ * Shared memory ring backend, see ShmRing.h. The sink closes the ring on
+ * finish() and the source removes its name at end of stream.
+ */
+std::unique_ptr<Source> shm_source(const std::string &name);
+std::unique_ptr<Sink> shm_sink(const std::string &name);
+
+#endif /* _FILEIO_H_ */
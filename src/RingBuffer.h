@@ -0,0 +1,112 @@
+#ifndef _RINGBUFFER_H_
+#define _RINGBUFFER_H_
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+/*
+ * Lock-free single producer, single consumer ring of preallocated slots. The
+ * producer fills back() in place and publishes it with push(). The consumer
+ * reads front() in place and returns the slot with pop(). Head and tail sit on
+ * separate cache lines so the two sides do not share a line.
+ *
+ * A waiting side yields for a short while and then sleeps until its peer
+ * pushes or pops, so idle stages of an I/O or compute bound pipeline do not
+ * occupy a core. The peer takes the lock only when a side is asleep. Sleeps
+ * time out to observe 'abort'.
+ */
+template <typename T>
+class RingBuffer {
+public:
+    RingBuffer(size_t n, const T &init = T())
+        : slots(n, init), head(0), tail(0) { }
+
+    bool full() const
+    {
+        return head.load(std::memory_order_relaxed) -
+               tail.load(std::memory_order_acquire) == slots.size();
+    }
+
+    bool empty() const
+    {
+        return tail.load(std::memory_order_relaxed) ==
+               head.load(std::memory_order_acquire);
+    }
+
+    T &back() { return slots[head.load(std::memory_order_relaxed) % slots.size()]; }
+    T &front() { return slots[tail.load(std::memory_order_relaxed) % slots.size()]; }
+
+    void push()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        signal();
+    }
+
+    void pop()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        signal();
+    }
+
+    /* Wait for a free slot or a filled slot. Return false if 'abort' is set. */
+    bool wait_back(const std::atomic<bool> &abort) const
+    {
+        return wait([this] { return !full(); }, abort);
+    }
+
+    bool wait_front(const std::atomic<bool> &abort) const
+    {
+        return wait([this] { return !empty(); }, abort);
+    }
+
+private:
+    static const unsigned spins = 64;
+    static constexpr std::chrono::milliseconds timeout { 10 };
+
+    template <typename F>
+    bool wait(F ready, const std::atomic<bool> &abort) const
+    {
+        for (unsigned i = 0; !ready(); i++) {
+            if (abort.load(std::memory_order_relaxed)) return false;
+            if (i < spins) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            waiters.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!ready()) cond.wait_for(lock, timeout);
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    /*
+     * The fence orders the index update before the check of 'waiters', so
+     * either the sleeper sees the update or the update sees the sleeper
+     */
+    void signal()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            cond.notify_all();
+        }
+    }
+
+    std::vector<T> slots;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    alignas(64) mutable std::atomic<unsigned> waiters { 0 };
+    mutable std::mutex mutex;
+    mutable std::condition_variable cond;
+};
+
+template <typename T>
+constexpr std::chrono::milliseconds RingBuffer<T>::timeout;
+
+#endif /* _RINGBUFFER_H_ */
@@ -0,0 +1,339 @@
+/*
+ * Shared Memory Ring
+ *
+ * Copyright (C) 2019 Tom Tsou <tom@tsou.cc>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <climits>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+#ifdef HAVE_LINUX_FUTEX_H
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#include "ShmRing.h"
+#include "FileIO.h"
+
+#define SHM_MAGIC       0x52535247
+#define SHM_VERSION     2
+#define SHM_HDRSIZE     4096
+
+/*
+ * Data bytes of rings created by the CLI
+ */
+#define SHM_RINGSIZE    (4 << 20)
+
+/*
+ * Futex wait timeout and the number of polls for an attaching side to find
+ * an initialized ring
+ */
+#define SHM_WAIT_NS     100000000
+#define SHM_ATTACH_POLL 5000
+
+using namespace std;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "Shared rings require lock-free atomics");
+
+static void wait_seq(atomic<uint32_t> &seq, uint32_t val)
+{
+#ifdef HAVE_LINUX_FUTEX_H
+    struct timespec ts = { 0, SHM_WAIT_NS };
+    syscall(SYS_futex, &seq, FUTEX_WAIT, val, &ts, NULL, 0);
+#else
+    if (seq.load() == val) this_thread::yield();
+#endif
+}
+
+static void publish(atomic<uint32_t> &seq, atomic<uint32_t> &waiting)
+{
+    seq.fetch_add(1);
+#ifdef HAVE_LINUX_FUTEX_H
+    if (waiting.load())
+        syscall(SYS_futex, &seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+static void *map_ring(int fd, size_t len)
+{
+    void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        throw runtime_error(string("Failed to map shared ring: ") + strerror(errno));
+    return addr;
+}
+
+/*
+ * A side is gone once it has let go of the ring or its process has exited.
+ * Zero is a side that has not attached yet.
+ */
+static bool alive(int32_t pid)
+{
+    return pid > 0 && (!kill(pid, 0) || errno == EPERM);
+}
+
+static bool gone(const atomic<int32_t> &pid)
+{
+    int32_t p = pid.load();
+    return p && !alive(p);
+}
+
+ShmRing::ShmRing(const string &name, size_t size, Role role)
+    : name(name[0] == '/' ? name : "/" + name), role(role)
+{
+    if (!size) throw invalid_argument("Invalid shared ring size");
+
+    /* A stale ring is removed once and the name created again */
+    for (int i = 0; !create(size) && !attach(); i++) {
+        if (i) throw runtime_error("Shared ring " + this->name + " could not be replaced");
+        shm_unlink(this->name.c_str());
+    }
+    data = (char *) hdr + SHM_HDRSIZE;
+}
+
+atomic<int32_t> &ShmRing::own()
+{
+    return role == Producer ? hdr->producer_pid : hdr->consumer_pid;
+}
+
+atomic<int32_t> &ShmRing::peer()
+{
+    return role == Producer ? hdr->consumer_pid : hdr->producer_pid;
+}
+
+/*
+ * Create, size and initialize the ring, or return false if the name exists
+ */
+bool ShmRing::create(size_t size)
+{
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        if (errno == EEXIST) return false;
+        throw runtime_error("Failed to open shared ring " + name + ": " + strerror(errno));
+    }
+    map_len = SHM_HDRSIZE + size;
+    if (ftruncate(fd, map_len) < 0) {
+        ::close(fd);
+        shm_unlink(name.c_str());
+        throw runtime_error(string("Failed to size shared ring: ") + strerror(errno));
+    }
+    hdr = (ShmRingHeader *) map_ring(fd, map_len);
+    ::close(fd);
+    hdr->version = SHM_VERSION;
+    hdr->size = size;
+    own().store(getpid());
+    hdr->magic.store(SHM_MAGIC);
+    return true;
+}
+
+/*
+ * Attach to a ring created by the peer. Returns false for a stale ring, so
+ * that it is replaced. A ring is stale if this side was taken by a process
+ * that has since exited, or if the peer has gone without closing the ring. A
+ * closed ring whose producer has exited still holds its stream for reading.
+ */
+bool ShmRing::attach()
+{
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        if (errno == ENOENT) return false;
+        throw runtime_error("Failed to open shared ring " + name + ": " + strerror(errno));
+    }
+
+    /* Wait for the creator to size and initialize the header */
+    struct stat st;
+    for (int i = 0; !fstat(fd, &st) && st.st_size < SHM_HDRSIZE; i++) {
+        if (i == SHM_ATTACH_POLL) {
+            ::close(fd);
+            throw runtime_error("Shared ring " + name + " was not initialized");
+        }
+        usleep(1000);
+    }
+    hdr = (ShmRingHeader *) map_ring(fd, SHM_HDRSIZE);
+    for (int i = 0; hdr->magic.load() != SHM_MAGIC; i++) {
+        if (i == SHM_ATTACH_POLL) {
+            munmap(hdr, SHM_HDRSIZE);
+            ::close(fd);
+            throw runtime_error("Shared ring " + name + " was not initialized");
+        }
+        usleep(1000);
+    }
+    size_t size = hdr->size;
+    bool valid = hdr->version == SHM_VERSION && size;
+    munmap(hdr, SHM_HDRSIZE);
+    if (!valid) {
+        ::close(fd);
+        throw runtime_error("Incompatible shared ring " + name);
+    }
+    map_len = SHM_HDRSIZE + size;
+    try {
+        hdr = (ShmRingHeader *) map_ring(fd, map_len);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+
+    int32_t mine = own().load();
+    if (alive(mine)) {
+        munmap(hdr, map_len);
+        throw runtime_error("Shared ring " + name + " already has a " +
+                            (role == Producer ? "producer" : "consumer"));
+    }
+    if (role == Producer && hdr->closed.load() && !peer().load()) {
+        munmap(hdr, map_len);
+        throw runtime_error("Shared ring " + name + " holds a stream not yet read");
+    }
+    bool abandoned = gone(peer()) && !hdr->closed.load();
+    if (mine || abandoned || !own().compare_exchange_strong(mine, getpid())) {
+        munmap(hdr, map_len);
+        return false;
+    }
+    return true;
+}
+
+ShmRing::~ShmRing()
+{
+    own().store(-1);
+    if (role == Producer)
+        publish(hdr->head_seq, hdr->head_waiting);
+    else
+        publish(hdr->tail_seq, hdr->tail_waiting);
+    munmap(hdr, map_len);
+}
+
+void ShmRing::write(const void *buf, size_t len)
+{
+    const char *p = (const char *) buf;
+    uint64_t size = hdr->size, head = hdr->head.load(memory_order_relaxed);
+
+    while (len) {
+        uint64_t space = size - (head - hdr->tail.load(memory_order_acquire));
+        if (!space) {
+            if (gone(peer()))
+                throw runtime_error("Shared ring " + name + " consumer exited");
+            uint32_t seq = hdr->tail_seq.load();
+            hdr->tail_waiting.store(1);
+            if (head - hdr->tail.load() == size) wait_seq(hdr->tail_seq, seq);
+            hdr->tail_waiting.store(0);
+            continue;
+        }
+
+        size_t n = min<uint64_t>(len, space);
+        size_t off = head % size, first = min<size_t>(n, size - off);
+        memcpy(data + off, p, first);
+        memcpy(data, p + first, n - first);
+        p += n, len -= n, head += n;
+        hdr->head.store(head);
+        publish(hdr->head_seq, hdr->head_waiting);
+    }
+}
+
+size_t ShmRing::read(void *buf, size_t len)
+{
+    char *p = (char *) buf;
+    uint64_t size = hdr->size, tail = hdr->tail.load(memory_order_relaxed);
+    size_t done = 0;
+
+    while (done < len) {
+        uint64_t avail = hdr->head.load(memory_order_acquire) - tail;
+        if (!avail) {
+            if (hdr->closed.load()) {
+                if (hdr->head.load() == tail) break;
+                continue;
+            }
+            if (gone(peer())) {
+                if (hdr->head.load() != tail || hdr->closed.load()) continue;
+                throw runtime_error("Shared ring " + name + " producer exited");
+            }
+            uint32_t seq = hdr->head_seq.load();
+            hdr->head_waiting.store(1);
+            if (hdr->head.load() == tail && !hdr->closed.load()) wait_seq(hdr->head_seq, seq);
+            hdr->head_waiting.store(0);
+            continue;
+        }
+
+        size_t n = min<uint64_t>(len - done, avail);
+        size_t off = tail % size, first = min<size_t>(n, size - off);
+        memcpy(p, data + off, first);
+        memcpy(p + first, data, n - first);
+        p += n, done += n, tail += n;
+        hdr->tail.store(tail);
+        publish(hdr->tail_seq, hdr->tail_waiting);
+    }
+    return done;
+}
+
+void ShmRing::close()
+{
+    hdr->closed.store(1);
+    publish(hdr->head_seq, hdr->head_waiting);
+}
+
+void ShmRing::unlink()
+{
+    shm_unlink(name.c_str());
+}
+
+/*
+ * CLI endpoints. The consumer removes the name once the stream has ended.
+ */
+class ShmSource : public Source {
+public:
+    ShmSource(const string &name) : ring(name, SHM_RINGSIZE, ShmRing::Consumer) { }
+
+    size_t read(void *buf, size_t len) override
+    {
+        size_t n;
+        try {
+            n = ring.read(buf, len);
+        } catch (...) {
+            ring.unlink();
+            throw;
+        }
+        if (n < len) ring.unlink();
+        return n;
+    }
+private:
+    ShmRing ring;
+};
+
+class ShmSink : public Sink {
+public:
+    ShmSink(const string &name) : ring(name, SHM_RINGSIZE, ShmRing::Producer) { }
+    void write(const void *buf, size_t len) override { ring.write(buf, len); }
+    void finish() override { ring.close(); }
+private:
+    ShmRing ring;
+};
+
+unique_ptr<Source> shm_source(const string &name)
+{
+    return unique_ptr<Source>(new ShmSource(name));
+}
+
+unique_ptr<Sink> shm_sink(const string &name)
+{
+    return unique_ptr<Sink>(new ShmSink(name));
+}
@@ -0,0 +1,77 @@
+#ifndef _SHMRING_H_
+#define _SHMRING_H_
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+/*
+ * Shared memory layout of a byte ring. The header occupies the first page and
+ * the data area follows. 'head' and 'tail' count bytes written and consumed
+ * and sit on separate cache lines. The 32-bit sequence words are futex
+ * addresses, bumped after every head or tail update, and the 'waiting' flags
+ * let each side skip the wake call when its peer is not asleep. The producer
+ * sets 'closed' after its final write. Each side records its process ID on
+ * attach and -1 once it lets go of the ring, so that the other side stops
+ * waiting for a peer that has gone. 'magic' is set last by the creator.
+ */
+struct ShmRingHeader {
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint64_t size;
+    std::atomic<int32_t> producer_pid;
+    std::atomic<int32_t> consumer_pid;
+    alignas(64) std::atomic<uint64_t> head;
+    std::atomic<uint32_t> head_seq;
+    std::atomic<uint32_t> head_waiting;
+    std::atomic<uint32_t> closed;
+    alignas(64) std::atomic<uint64_t> tail;
+    std::atomic<uint32_t> tail_seq;
+    std::atomic<uint32_t> tail_waiting;
+};
+
+/*
+ * Single producer, single consumer byte ring between processes on a POSIX
+ * shared memory object. Either side may start first. The first to open the
+ * name creates and sizes the ring, the other attaches to it. A ring left by
+ * processes that have all exited is replaced, and a ring whose side is taken
+ * by a live process is rejected. Data is copied directly between the caller's
+ * buffer and the mapped ring, with no kernel copies, and a blocked side sleeps
+ * on a futex.
+ */
+class ShmRing {
+public:
+    enum Role { Producer, Consumer };
+
+    ShmRing(const std::string &name, size_t size, Role role);
+    ~ShmRing();
+
+    /* Write all of 'buf', waiting for space as needed. Throws if the consumer exits. */
+    void write(const void *buf, size_t len);
+
+    /*
+     * Fill 'buf', returning short only once the producer closed the ring.
+     * Throws if the producer exits without closing it.
+     */
+    size_t read(void *buf, size_t len);
+
+    /* Mark the end of the stream */
+    void close();
+
+    /* Remove the name. The mapping stays valid until destruction. */
+    void unlink();
+
+private:
+    std::string name;
+    Role role;
+    ShmRingHeader *hdr;
+    char *data;
+    size_t map_len;
+
+    bool create(size_t size);
+    bool attach();
+    std::atomic<int32_t> &own();
+    std::atomic<int32_t> &peer();
+};
+
+#endif /* _SHMRING_H_ */
@@ -0,0 +1,373 @@
+/*
+ * io_uring File I/O
+ *
+ * Copyright (C) 2019 Tom Tsou <tom@tsou.cc>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FileIO.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+
+/*
+ * Requests kept in flight, size of each request and buffer alignment, which
+ * covers the logical block size required for direct I/O
+ */
+#define URING_DEPTH     8
+#define URING_BUFSIZE   (1 << 20)
+#define URING_ALIGN     4096
+
+using namespace std;
+
+/*
+ * Minimal io_uring submission and completion handling on the raw system call
+ * interface. One vectored request per buffer, tagged with the buffer index.
+ */
+class Uring {
+public:
+    Uring(unsigned entries);
+    ~Uring();
+
+    static bool available();
+
+    void submit(int op, int fd, struct iovec *iov, off_t offset, unsigned tag);
+    void wait(int &res, unsigned &tag);
+
+private:
+    int fd;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static int uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+bool Uring::available()
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = uring_setup(1, &p);
+    if (fd < 0) return false;
+    close(fd);
+    return true;
+}
+
+Uring::Uring(unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    fd = uring_setup(entries, &p);
+    if (fd < 0)
+        throw runtime_error(string("io_uring setup failed: ") + strerror(errno));
+
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sq_len = cq_len = max(sq_len, cq_len);
+
+    sq_ptr = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  fd, IORING_OFF_SQ_RING);
+    cq_ptr = p.features & IORING_FEAT_SINGLE_MMAP ? sq_ptr :
+             mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  fd, IORING_OFF_CQ_RING);
+    sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe *) mmap(NULL, sqes_len, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || sqes == MAP_FAILED) {
+        close(fd);
+        throw runtime_error("io_uring ring mapping failed");
+    }
+
+    sq_tail = (unsigned *) ((char *) sq_ptr + p.sq_off.tail);
+    sq_mask = (unsigned *) ((char *) sq_ptr + p.sq_off.ring_mask);
+    sq_array = (unsigned *) ((char *) sq_ptr + p.sq_off.array);
+    cq_head = (unsigned *) ((char *) cq_ptr + p.cq_off.head);
+    cq_tail = (unsigned *) ((char *) cq_ptr + p.cq_off.tail);
+    cq_mask = (unsigned *) ((char *) cq_ptr + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *) ((char *) cq_ptr + p.cq_off.cqes);
+}
+
+Uring::~Uring()
+{
+    munmap(sqes, sqes_len);
+    if (cq_ptr != sq_ptr) munmap(cq_ptr, cq_len);
+    munmap(sq_ptr, sq_len);
+    close(fd);
+}
+
+void Uring::submit(int op, int file, struct iovec *iov, off_t offset, unsigned tag)
+{
+    unsigned tail = *sq_tail;
+    unsigned index = tail & *sq_mask;
+    struct io_uring_sqe *sqe = &sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = file;
+    sqe->addr = (unsigned long) iov;
+    sqe->len = 1;
+    sqe->off = offset;
+    sqe->user_data = tag;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    while (uring_enter(fd, 1, 0, 0) < 0)
+        if (errno != EINTR)
+            throw runtime_error(string("io_uring submit failed: ") + strerror(errno));
+}
+
+void Uring::wait(int &res, unsigned &tag)
+{
+    for (;;) {
+        unsigned head = *cq_head;
+        if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+            res = cqe->res;
+            tag = cqe->user_data;
+            __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+            return;
+        }
+        if (uring_enter(fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+            throw runtime_error(string("io_uring wait failed: ") + strerror(errno));
+    }
+}
+
+struct UringBuffer {
+    char *data;
+    struct iovec iov;
+    size_t len;
+    int res;
+    bool busy;
+};
+
+/*
+ * Direct I/O is requested first and dropped on filesystems that reject it
+ */
+static int open_direct(const string &path, int flags)
+{
+    int fd = open(path.c_str(), flags | O_DIRECT, 0644);
+    if (fd < 0 && errno == EINVAL)
+        fd = open(path.c_str(), flags, 0644);
+    return fd;
+}
+
+class UringFile {
+protected:
+    UringFile() : ring(URING_DEPTH), bufs(URING_DEPTH) { }
+
+    ~UringFile()
+    {
+        for (unsigned n = 0; n < bufs.size(); n++)
+            while (bufs[n].busy) reap();
+        for (auto &b:bufs) free(b.data);
+        if (fd >= 0) close(fd);
+    }
+
+    void alloc()
+    {
+        for (auto &b:bufs) {
+            if (posix_memalign((void **) &b.data, URING_ALIGN, URING_BUFSIZE))
+                throw bad_alloc();
+            b.len = 0;
+            b.iov.iov_len = 0;
+            b.busy = false;
+        }
+    }
+
+    void reap()
+    {
+        int res;
+        unsigned tag;
+        ring.wait(res, tag);
+        bufs[tag].res = res;
+        bufs[tag].busy = false;
+    }
+
+    void submit(int op, unsigned n, size_t len)
+    {
+        auto &b = bufs[n];
+        b.iov.iov_base = b.data;
+        b.iov.iov_len = len;
+        b.busy = true;
+        ring.submit(op, fd, &b.iov, offset, n);
+        offset += len;
+    }
+
+    Uring ring;
+    vector<UringBuffer> bufs;
+    int fd = -1;
+    off_t offset = 0;
+    unsigned cur = 0;
+};
+
+/*
+ * Reads are issued ahead into every buffer and consumed in order. A short
+ * read marks the end of the file.
+ */
+class UringSource : public Source, UringFile {
+public:
+    UringSource(const string &path)
+    {
+        alloc();
+        fd = open_direct(path, O_RDONLY);
+        if (fd < 0)
+            throw runtime_error("Failed to open input file " + path);
+        for (unsigned n = 0; n < bufs.size(); n++)
+            submit(IORING_OP_READV, n, URING_BUFSIZE);
+    }
+
+    size_t read(void *buf, size_t len) override
+    {
+        size_t n = 0;
+        while (n < len && !eof) {
+            auto &b = bufs[cur];
+            while (b.busy) reap();
+            if (b.res < 0)
+                throw runtime_error(string("Failed to read input file: ") + strerror(-b.res));
+
+            size_t k = min(len - n, b.res - pos);
+            memcpy((char *) buf + n, b.data + pos, k);
+            n += k, pos += k;
+
+            if (pos == (size_t) b.res) {
+                if (b.res < URING_BUFSIZE) {
+                    eof = true;
+                    break;
+                }
+                submit(IORING_OP_READV, cur, URING_BUFSIZE);
+                cur = (cur + 1) % bufs.size();
+                pos = 0;
+            }
+        }
+        return n;
+    }
+
+private:
+    size_t pos = 0;
+    bool eof = false;
+};
+
+/*
+ * Output is gathered into full buffers and written behind. The final partial
+ * buffer is padded to the direct I/O alignment and the file is truncated to
+ * its real length.
+ */
+class UringSink : public Sink, UringFile {
+public:
+    UringSink(const string &path) : path(path)
+    {
+        alloc();
+        fd = open_direct(path, O_WRONLY | O_CREAT | O_TRUNC);
+        if (fd < 0)
+            throw runtime_error("Failed to open output file " + path);
+    }
+
+    void write(const void *buf, size_t len) override
+    {
+        for (size_t n = 0; n < len;) {
+            auto &b = bufs[cur];
+            wait(cur);
+
+            size_t k = min(len - n, URING_BUFSIZE - b.len);
+            memcpy(b.data + b.len, (const char *) buf + n, k);
+            n += k, b.len += k;
+
+            if (b.len == URING_BUFSIZE) {
+                submit(IORING_OP_WRITEV, cur, URING_BUFSIZE);
+                cur = (cur + 1) % bufs.size();
+            }
+        }
+    }
+
+    void finish() override
+    {
+        auto &b = bufs[cur];
+        size_t total = offset + b.len;
+        if (b.len) {
+            size_t padded = (b.len + URING_ALIGN - 1) / URING_ALIGN * URING_ALIGN;
+            memset(b.data + b.len, 0, padded - b.len);
+            submit(IORING_OP_WRITEV, cur, padded);
+        }
+        for (unsigned n = 0; n < bufs.size(); n++)
+            wait(n);
+        if (ftruncate(fd, total) < 0)
+            throw runtime_error("Failed to write output file " + path);
+    }
+
+private:
+    /* Wait for a submitted buffer to drain and check the result of its write */
+    void wait(unsigned n)
+    {
+        auto &b = bufs[n];
+        if (!b.iov.iov_len) return;
+        while (b.busy) reap();
+        if (b.res != (int) b.iov.iov_len)
+            throw runtime_error("Failed to write output file " + path);
+        b.iov.iov_len = 0;
+        b.len = 0;
+    }
+
+    string path;
+};
+
+unique_ptr<Source> uring_source(const string &path)
+{
+    if (!Uring::available()) return nullptr;
+    return unique_ptr<Source>(new UringSource(path));
+}
+
+unique_ptr<Sink> uring_sink(const string &path)
+{
+    if (!Uring::available()) return nullptr;
+    return unique_ptr<Sink>(new UringSink(path));
+}
+
+#else
+
+std::unique_ptr<Source> uring_source(const std::string &path)
+{
+    return nullptr;
+}
+
+std::unique_ptr<Sink> uring_sink(const std::string &path)
+{
+    return nullptr;
+}
+
+#endif
@@ -18,11 +18,27 @@
  */
 
 #include <algorithm>
+#include <chrono>
 #include <complex>
 #include <vector>
 #include <stdexcept>
+#include <limits>
+#include <climits>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef HAVE_SYS_SDT_H
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#endif
 
 #include "Resampler.h"
+#include "ThreadPool.h"
 
 /*
  * Undefine to remove saturating accumulation on integral types
@@ -35,12 +51,60 @@
  */
 #define DEFAULT_PATH_LEN		128
 
+/*
+ * Number of accumulators computed before conversion to the output type
+ */
+#define OUTPUT_BATCH			64
+
+/*
+ * Number of interleaved scalars filtered together by the multichannel loop
+ */
+#define LANE_BLOCK			16
+
+/*
+ * Outputs per unit of work in threaded operation. Blocks shorter than two
+ * chunks run on the calling thread only.
+ */
+#define PARALLEL_CHUNK			4096
+
+/*
+ * Static tracepoints of the 'resample' provider, which are single no-op
+ * instructions until a tracer attaches
+ *
+ *   call__start(P, Q, n_in, n_out, sample_bytes)
+ *   call__done(P, Q, n_in, n_out, nanoseconds)
+ *   resize(P, Q, old_len, new_len)
+ *   design(P, Q, taps, cached, nanoseconds)
+ */
+#ifdef HAVE_SYS_SDT_H
+#define TRACE(...) STAP_PROBEV(resample, __VA_ARGS__)
+#define TRACE_ENABLED(NAME) __builtin_expect(resample_##NAME##_semaphore, 0)
+#else
+#define TRACE(...)
+#define TRACE_ENABLED(NAME) false
+#endif
+
+/*
+ * Probe semaphores, counted up by the tracer while a probe is attached, so
+ * that probe arguments which cost more than a register read are only computed
+ * for an attached tracer
+ */
+#ifdef HAVE_SYS_SDT_H
+#define TRACE_SEMAPHORE(NAME) \
+    volatile unsigned short resample_##NAME##_semaphore \
+        __attribute__((unused)) __attribute__((section(".probes")));
+
+TRACE_SEMAPHORE(call__start)
+TRACE_SEMAPHORE(call__done)
+TRACE_SEMAPHORE(resize)
+TRACE_SEMAPHORE(design)
+#endif
+
 using namespace std;
 
-Resampler::Resampler(unsigned P, unsigned Q, unsigned taps)
-    : partitions(P, vector<double>(taps)), P(P), Q(Q)
+Resampler::Resampler(unsigned P, unsigned Q, unsigned taps, bool narrow)
+    : filterbank(design(P, Q, taps, narrow)), P(P), Q(Q)
 {
-    init(taps, P > Q ? P : Q);
     resize(DEFAULT_PATH_LEN);
 }
 
@@ -50,9 +114,10 @@ Resampler::Resampler(unsigned P, unsigned Q, unsigned taps)
  *
  * https://en.wikipedia.org/wiki/Window_function#Blackman-Harris_window
  */
-void Resampler::init(unsigned taps, double cutoff)
+static void init(vector<vector<double>> &partitions, unsigned taps, double cutoff)
 {
-    vector<double> proto(partitions.size() * taps);
+    unsigned P = partitions.size();
+    vector<double> proto(P * taps);
     double a[] = { 0.35875, 0.48829, 0.14128, 0.01168 };
     double beta, i = 0.0, sum = 0.0;
 
@@ -70,97 +135,660 @@ void Resampler::init(unsigned taps, double cutoff)
         sum += p;
         i++;
     }
-    beta = partitions.size() / sum;
+    beta = P / sum;
     for (unsigned j = 0; j < taps; j++)
         for (unsigned p = 0; p < P; p++)
             partitions[p][j] = proto[j * P + p] * beta;
     for (auto &p:partitions) reverse(p.begin(), p.end());
 }
 
-template <typename T>
-ComplexResampler<T>::ComplexResampler(unsigned P, unsigned Q, unsigned taps)
-    : Resampler(P, Q, taps), history(taps-1)
+/*
+ * Banks are cached by weak reference, so a bank lives as long as some
+ * resampler uses it. Single precision banks are the double design rounded
+ * once.
+ */
+shared_ptr<const Filterbank> Resampler::design(unsigned P, unsigned Q, unsigned taps, bool narrow)
 {
+    static mutex cache_mutex;
+    static map<tuple<unsigned, unsigned, unsigned, bool>, weak_ptr<const Filterbank>> cache;
+
+    if (!P || !Q || !taps) throw invalid_argument("Invalid resampler parameters");
 
+    auto key = make_tuple(P, Q, taps, narrow);
+    {
+        lock_guard<mutex> lock(cache_mutex);
+        auto it = cache.find(key);
+        auto bank = it != cache.end() ? it->second.lock() : nullptr;
+        if (bank) {
+            TRACE(design, P, Q, taps, 1, 0);
+            return bank;
+        }
+    }
+
+    /*
+     * Design without the lock, so that a long design does not hold up
+     * resamplers of other parameters. Should another thread finish an equal
+     * bank first, its bank is returned and this one discarded.
+     */
+#ifdef HAVE_SYS_SDT_H
+    bool timed = TRACE_ENABLED(design);
+    auto start = timed ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+#endif
+    auto fb = make_shared<Filterbank>();
+    fb->partitions.assign(P, vector<double>(taps));
+    init(fb->partitions, taps, P > Q ? P : Q);
+    if (narrow) {
+        fb->fpartitions.resize(P);
+        for (size_t p = 0; p < P; p++)
+            fb->fpartitions[p].assign(fb->partitions[p].begin(), fb->partitions[p].end());
+    }
+#ifdef HAVE_SYS_SDT_H
+    if (timed) {
+        uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - start).count();
+        TRACE(design, P, Q, taps, 0, ns);
+    }
+#endif
+
+    lock_guard<mutex> lock(cache_mutex);
+    auto bank = cache[key].lock();
+    if (bank) return bank;
+    cache[key] = fb;
+
+    /* Drop entries of banks that no resampler holds any longer */
+    for (auto it = cache.begin(); it != cache.end();) {
+        if (it->second.expired()) it = cache.erase(it);
+        else ++it;
+    }
+    return fb;
+}
+
+void Resampler::set_threads(unsigned n)
+{
+    if (!n) throw invalid_argument("Invalid thread count");
+    pool = n > 1 ? make_shared<ThreadPool>(n) : nullptr;
 }
 
+Resampler::Resampler(const Resampler &r)
+    : filterbank(r.filterbank), paths(r.paths),
+      pool(r.pool ? make_shared<ThreadPool>(r.pool->size()) : nullptr),
+      counters(r.counters), P(r.P), Q(r.Q)
+{
+}
+
+Resampler &Resampler::operator=(const Resampler &r)
+{
+    if (this == &r) return *this;
+    filterbank = r.filterbank;
+    paths = r.paths;
+    pool = r.pool ? make_shared<ThreadPool>(r.pool->size()) : nullptr;
+    counters = r.counters;
+    P = r.P;
+    Q = r.Q;
+    return *this;
+}
+
+ResamplerStats Resampler::Counters::snapshot() const
+{
+    ResamplerStats s;
+    s.calls = calls.load(memory_order_relaxed);
+    s.samples_in = samples_in.load(memory_order_relaxed);
+    s.samples_out = samples_out.load(memory_order_relaxed);
+    s.nanoseconds = nanoseconds.load(memory_order_relaxed);
+    s.resizes = resizes.load(memory_order_relaxed);
+    s.history_bytes = history_bytes.load(memory_order_relaxed);
+    return s;
+}
+
+void Resampler::Counters::store(const ResamplerStats &s)
+{
+    calls.store(s.calls, memory_order_relaxed);
+    samples_in.store(s.samples_in, memory_order_relaxed);
+    samples_out.store(s.samples_out, memory_order_relaxed);
+    nanoseconds.store(s.nanoseconds, memory_order_relaxed);
+    resizes.store(s.resizes, memory_order_relaxed);
+    history_bytes.store(s.history_bytes, memory_order_relaxed);
+}
+
+Resampler::Counters &Resampler::Counters::operator=(const Counters &c)
+{
+    store(c.snapshot());
+    return *this;
+}
+
+void Resampler::Counters::reset()
+{
+    store(ResamplerStats());
+}
+
+unsigned Resampler::threads() const
+{
+    return pool ? pool->size() : 1;
+}
+
+/*
+ * Run fn(first, last, worker) over the output range [0, len). Worker indices
+ * are less than threads() and identify per thread scratch space. The callable
+ * is taken by reference rather than wrapped, so that dispatching a call does
+ * not allocate.
+ */
+template <typename F>
+void Resampler::dispatch(size_t len, const F &fn)
+{
+    if (!pool || len < 2 * PARALLEL_CHUNK) {
+        fn(0, len, 0);
+        return;
+    }
+
+    size_t chunks = (len + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+    pool->parallel(chunks, [&](size_t i, unsigned worker) {
+        fn(i * PARALLEL_CHUNK, min(len, (i + 1) * PARALLEL_CHUNK), worker);
+    });
+}
+
+template <>
+const vector<vector<double>> &Resampler::bank<double>() const
+{
+    return filterbank->partitions;
+}
+
+template <>
+const vector<vector<float>> &Resampler::bank<float>() const
+{
+    return filterbank->fpartitions;
+}
+
+template <typename T, Precision R>
+ComplexResampler<T, R>::ComplexResampler(unsigned P, unsigned Q, unsigned taps)
+    : Resampler(P, Q, taps, R == Precision::Float), history(taps-1), head(2*(taps-1)),
+      planes(4*(taps-1))
+{
+    static_assert(R == Precision::Double || is_floating_point<T>::value,
+                  "Float precision requires floating point samples");
+}
+
+template <typename T, Precision R>
+MultiResampler<T, R>::MultiResampler(unsigned P, unsigned Q, unsigned channels, unsigned taps)
+    : Resampler(P, Q, taps, R == Precision::Float), N(channels), history((taps-1) * channels),
+      accum(channels), row(channels)
+{
+    static_assert(R == Precision::Double || is_floating_point<T>::value,
+                  "Float precision requires floating point samples");
+    if (!channels) throw invalid_argument("Invalid channel count");
+}
+
+template <typename T, Precision R>
+RealResampler<T, R>::RealResampler(unsigned P, unsigned Q, unsigned taps)
+    : Resampler(P, Q, taps, R == Precision::Float), history(taps-1), head(2*(taps-1))
+{
+    static_assert(R == Precision::Double || is_floating_point<T>::value,
+                  "Float precision requires floating point samples");
+}
+
+/*
+ * Output conversion. Accumulators are converted in batches with rounding to
+ * nearest and, for integral types, saturation to the range of the output type.
+ * Clamping is done in double before the conversion, so the upper bound of
+ * 64-bit types is pulled below 2^63 where the double value would overflow.
+ */
 template <typename T>
-RealResampler<T>::RealResampler(unsigned P, unsigned Q, unsigned taps)
-    : Resampler(P, Q, taps), history(taps-1)
+static inline double saturation_max()
+{
+    double hi = numeric_limits<T>::max();
+    if (hi >= ldexp(1.0, numeric_limits<T>::digits))
+        hi = nextafter(hi, 0.0);
+    return hi;
+}
+
+template <typename A, typename T>
+static void convert(const A *in, T *out, size_t n, false_type)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = in[i];
+}
+
+template <typename A, typename T>
+static void convert(const A *in, T *out, size_t n, true_type)
+{
+#ifdef SATURATE
+    const double lo = numeric_limits<T>::min();
+    const double hi = saturation_max<T>();
+    for (size_t i = 0; i < n; i++)
+        out[i] = rint(min(max((double) in[i], lo), hi));
+#else
+    for (size_t i = 0; i < n; i++)
+        out[i] = rint(in[i]);
+#endif
+}
+
+template <typename A, typename T>
+static inline void convert(const A *in, T *out, size_t n)
+{
+    convert(in, out, n, is_integral<T>());
+}
+
+#if defined(__SSE2__) && defined(SATURATE)
+/*
+ * SSE2 conversion of 32, 16 and 8-bit outputs. Clamped values are converted
+ * with cvtpd2dq, which rounds to nearest under the default MXCSR mode, and
+ * narrowed with signed saturating packs.
+ */
+static inline __m128i convert_sse2(const double *in, __m128d lo, __m128d hi)
+{
+    __m128d a = _mm_min_pd(_mm_max_pd(_mm_loadu_pd(in + 0), lo), hi);
+    __m128d b = _mm_min_pd(_mm_max_pd(_mm_loadu_pd(in + 2), lo), hi);
+    return _mm_unpacklo_epi64(_mm_cvtpd_epi32(a), _mm_cvtpd_epi32(b));
+}
+
+static inline void convert(const double *in, int *out, size_t n)
 {
+    const __m128d lo = _mm_set1_pd(INT_MIN), hi = _mm_set1_pd(INT_MAX);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_si128((__m128i *) (out + i), convert_sse2(in + i, lo, hi));
+    convert(in + i, out + i, n - i, true_type());
+}
 
+static inline void convert(const double *in, short *out, size_t n)
+{
+    const __m128d lo = _mm_set1_pd(SHRT_MIN), hi = _mm_set1_pd(SHRT_MAX);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = convert_sse2(in + i + 0, lo, hi);
+        __m128i b = convert_sse2(in + i + 4, lo, hi);
+        _mm_storeu_si128((__m128i *) (out + i), _mm_packs_epi32(a, b));
+    }
+    convert(in + i, out + i, n - i, true_type());
 }
 
-#define COPY_INPUT(T) \
-    if (input.size() % Q || output.size() % P || input.size() / Q != output.size() / P) \
+#if CHAR_MIN < 0
+static inline void convert(const double *in, char *out, size_t n)
+{
+    const __m128d lo = _mm_set1_pd(CHAR_MIN), hi = _mm_set1_pd(CHAR_MAX);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = convert_sse2(in + i + 0, lo, hi);
+        __m128i b = convert_sse2(in + i + 4, lo, hi);
+        __m128i c = convert_sse2(in + i + 8, lo, hi);
+        __m128i d = convert_sse2(in + i + 12, lo, hi);
+        __m128i e = _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128((__m128i *) (out + i), e);
+    }
+    convert(in + i, out + i, n - i, true_type());
+}
+#endif
+#endif
+
+/*
+ * Instance counters. A call is counted once it completes, with its sample
+ * counts, elapsed time and bytes of history copied.
+ */
+#ifdef RESAMPLER_NO_STATS
+#define STATS_ADD(N_IN, N_OUT, HIST_BYTES, NS)
+#define STATS_RESIZE()
+#else
+#define STATS_ADD(N_IN, N_OUT, HIST_BYTES, NS) \
+    counters.calls.fetch_add(1, memory_order_relaxed); \
+    counters.samples_in.fetch_add((N_IN), memory_order_relaxed); \
+    counters.samples_out.fetch_add((N_OUT), memory_order_relaxed); \
+    counters.history_bytes.fetch_add((HIST_BYTES), memory_order_relaxed); \
+    counters.nanoseconds.fetch_add((NS), memory_order_relaxed);
+#define STATS_RESIZE() \
+    counters.resizes.fetch_add(1, memory_order_relaxed);
+#endif
+
+/*
+ * Call accounting shared by the counters and tracepoints. The call is timed
+ * if the counters are compiled in or a tracer is attached to call__done.
+ */
+#ifdef RESAMPLER_NO_STATS
+#define CALL_TIMED() TRACE_ENABLED(call__done)
+#else
+#define CALL_TIMED() true
+#endif
+
+#if defined(RESAMPLER_NO_STATS) && !defined(HAVE_SYS_SDT_H)
+#define CALL_START(N_IN, N_OUT, BYTES)
+#define CALL_STOP(N_IN, N_OUT, HIST_BYTES)
+#else
+#define CALL_START(N_IN, N_OUT, BYTES) \
+    TRACE(call__start, P, Q, (N_IN), (N_OUT), (BYTES)); \
+    bool call_timed = CALL_TIMED(); \
+    auto call_start = call_timed ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+#define CALL_STOP(N_IN, N_OUT, HIST_BYTES) \
+    uint64_t call_ns = call_timed ? chrono::duration_cast<chrono::nanoseconds>( \
+        chrono::steady_clock::now() - call_start).count() : 0; \
+    STATS_ADD(N_IN, N_OUT, HIST_BYTES, call_ns) \
+    TRACE(call__done, P, Q, (N_IN), (N_OUT), call_ns);
+#endif
+
+#define CHECK_SIZES(N_IN, N_OUT, N_MIN) \
+    if ((N_IN) % Q || (N_OUT) % P || (N_IN) / Q != (N_OUT) / P) \
         throw invalid_argument("Invalid vector size(s)"); \
+    if ((N_IN) < (N_MIN)) \
+        throw invalid_argument("Input size is less than the minimum supported size"); \
+    if ((N_OUT) > paths.size()) { \
+        resize(N_OUT); \
+        STATS_RESIZE() \
+    }
+
+#define PRIME_HISTORY() \
     if (input.size() < history.size()) \
         throw invalid_argument("Input size is less than the minimum supported size"); \
-    if (output.size() > paths.size()) resize(output.size()); \
-    vector<T> x(input.size() + history.size()); \
-    copy(history.begin(), history.end(), x.begin()); \
-    copy(input.begin(), input.end(), x.begin()+history.size()); \
     copy(input.end()-history.size(), input.end(), history.begin());
 
-template <typename T>
-void ComplexResampler<T>::resample(const vector<complex<T>> &input, vector<complex<T>> &output)
-{
-    COPY_INPUT(complex<T>)
-
-    auto pi = begin(paths);
-    for (auto oi = output.begin(); oi != output.end(); oi++) {
-        auto h = partitions[pi->second];
-        auto xi = x.begin() + pi->first;
-        complex<double> accum(0.0);
-        auto xii = xi;
-        for (auto hi = h.begin(); hi != h.end(); hi++, xii++)
-            accum += complex<double>(*hi * xii->real(), *hi * xii->imag());
-#ifdef SATURATE
-        if (is_integral<T>::value) {
-            double a = accum.real();
-            double b = accum.imag();
-            a = max((double) numeric_limits<T>::min(), a);
-            a = min((double) numeric_limits<T>::max(), a);
-            b = max((double) numeric_limits<T>::min(), b);
-            b = min((double) numeric_limits<T>::max(), b);
-            accum = complex<double>(a, b);
+#define CHECK_PLANAR(A, B) \
+    if ((A).size() != (B).size()) \
+        throw invalid_argument("Mismatched I/Q vector sizes");
+
+/*
+ * Filter loops over 'len' outputs starting at path 'pi'. Path offsets index
+ * 'x' after subtracting 'base'. The real loop also runs planar complex data as
+ * two independent passes over the I and Q planes.
+ */
+template <typename A, typename X, typename T>
+static void filter(const vector<vector<A>> &filters, const pair<size_t, unsigned> *pi,
+                   const X *x, T *out, size_t len, size_t base = 0)
+{
+    A accum[OUTPUT_BATCH];
+    for (size_t n = 0; n < len; n += OUTPUT_BATCH) {
+        size_t batch = min<size_t>(OUTPUT_BATCH, len - n);
+        for (size_t k = 0; k < batch; k++, pi++) {
+            const auto &h = filters[pi->second];
+            auto xii = x + (pi->first - base);
+            A a = 0.0;
+            for (auto hi = h.begin(); hi != h.end(); hi++)
+                a += *hi * (A) *xii++;
+            accum[k] = a;
         }
-#endif
-        *oi = accum;
-        pi++;
+        convert(accum, out + n, batch);
     }
 }
 
-template <typename T>
-void RealResampler<T>::resample(const vector<T> &input, vector<T> &output)
-{
-    COPY_INPUT(T)
-
-    auto pi = begin(paths);
-    for (auto oi = output.begin(); oi != output.end(); oi++) {
-        auto h = partitions[pi->second];
-        auto xi = x.begin() + pi->first;
-        double accum = 0.0;
-        auto xii = xi;
-        for (auto hi = h.begin(); hi != h.end(); hi++)
-            accum += *hi * (double) *xii++;
-#ifdef SATURATE
-        if (is_integral<T>::value) {
-            accum = max((double) numeric_limits<T>::min(), accum);
-            accum = min((double) numeric_limits<T>::max(), accum);
+template <typename A, typename X, typename T>
+static void filter(const vector<vector<A>> &filters, const pair<size_t, unsigned> *pi,
+                   const complex<X> *x, complex<T> *out, size_t len, size_t base = 0)
+{
+    complex<A> accum[OUTPUT_BATCH];
+    for (size_t n = 0; n < len; n += OUTPUT_BATCH) {
+        size_t batch = min<size_t>(OUTPUT_BATCH, len - n);
+        for (size_t k = 0; k < batch; k++, pi++) {
+            const auto &h = filters[pi->second];
+            auto xii = x + (pi->first - base);
+            complex<A> a(0.0);
+            for (auto hi = h.begin(); hi != h.end(); hi++, xii++)
+                a += complex<A>(*hi * (A) xii->real(), *hi * (A) xii->imag());
+            accum[k] = a;
         }
-#endif
-        *oi = accum;
-        pi++;
+        convert((const A *) accum, (T *) (out + n), 2 * batch);
     }
 }
 
+/*
+ * Complex filter loop over interleaved input with the I and Q accumulators
+ * converted to separate planar outputs
+ */
+template <typename A, typename X, typename T>
+static void filter(const vector<vector<A>> &filters, const pair<size_t, unsigned> *pi,
+                   const complex<X> *x, T *out_i, T *out_q, size_t len, size_t base = 0)
+{
+    A accum_i[OUTPUT_BATCH], accum_q[OUTPUT_BATCH];
+    for (size_t n = 0; n < len; n += OUTPUT_BATCH) {
+        size_t batch = min<size_t>(OUTPUT_BATCH, len - n);
+        for (size_t k = 0; k < batch; k++, pi++) {
+            const auto &h = filters[pi->second];
+            auto xii = x + (pi->first - base);
+            A ai = 0.0, aq = 0.0;
+            for (auto hi = h.begin(); hi != h.end(); hi++, xii++) {
+                ai += *hi * (A) xii->real();
+                aq += *hi * (A) xii->imag();
+            }
+            accum_i[k] = ai;
+            accum_q[k] = aq;
+        }
+        convert(accum_i, out_i + n, batch);
+        convert(accum_q, out_q + n, batch);
+    }
+}
+
+/*
+ * Outputs with a filter window inside the input read it in place. Leading
+ * outputs that reach back into the history read from 'head', which holds the
+ * history followed by the first taps-1 input samples.
+ */
+#define RESAMPLE_IN_PLACE() \
+    CALL_START(input_len, output_len, sizeof(*input)) \
+    CHECK_SIZES(input_len, output_len, history.size()) \
+    size_t h = history.size(); \
+    size_t split = min<size_t>(output_len, (h * P + Q - 1) / Q); \
+    copy(history.begin(), history.end(), head.begin()); \
+    copy(input, input + h, head.begin() + h); \
+    copy(input + input_len - h, input + input_len, history.begin()); \
+    const auto &filters = bank<accum_t>(); \
+    dispatch(output_len, [&](size_t first, size_t last, unsigned) { \
+        size_t mid = min(max(split, first), last); \
+        filter(filters, paths.data() + first, head.data(), output + first, mid - first); \
+        filter(filters, paths.data() + mid, input, output + mid, last - mid, h); \
+    }); \
+    CALL_STOP(input_len, output_len, 3 * h * sizeof(*input))
+
+template <typename T, Precision R>
+void ComplexResampler<T, R>::resample(const complex<T> *input, size_t input_len,
+                                      complex<T> *output, size_t output_len)
+{
+    RESAMPLE_IN_PLACE()
+}
+
+template <typename T, Precision R>
+void ComplexResampler<T, R>::resample(const vector<complex<T>> &input, vector<complex<T>> &output)
+{
+    resample(input.data(), input.size(), output.data(), output.size());
+}
+
+template <typename T, Precision R>
+void ComplexResampler<T, R>::prime(const vector<complex<T>> &input)
+{
+    PRIME_HISTORY()
+}
+
+/*
+ * Planar input is read in place as in RESAMPLE_IN_PLACE, with the head window
+ * of each plane held in 'planes'
+ */
+template <typename T, Precision R>
+void ComplexResampler<T, R>::resample(const vector<T> &input_i, const vector<T> &input_q,
+                                      vector<T> &output_i, vector<T> &output_q)
+{
+    CALL_START(input_i.size(), output_i.size(), sizeof(complex<T>))
+    CHECK_PLANAR(input_i, input_q)
+    CHECK_PLANAR(output_i, output_q)
+    CHECK_SIZES(input_i.size(), output_i.size(), history.size())
+
+    size_t h = history.size(), n = input_i.size();
+    size_t split = min<size_t>(output_i.size(), (h * P + Q - 1) / Q);
+    T *head_i = planes.data(), *head_q = planes.data() + 2 * h;
+    for (size_t k = 0; k < h; k++) {
+        head_i[k] = history[k].real();
+        head_q[k] = history[k].imag();
+    }
+    copy(input_i.begin(), input_i.begin() + h, head_i + h);
+    copy(input_q.begin(), input_q.begin() + h, head_q + h);
+    for (size_t k = 0; k < h; k++)
+        history[k] = complex<T>(input_i[n - h + k], input_q[n - h + k]);
+
+    const auto &filters = bank<accum_t>();
+    dispatch(output_i.size(), [&](size_t first, size_t last, unsigned) {
+        size_t mid = min(max(split, first), last);
+        filter(filters, paths.data() + first, head_i, output_i.data() + first, mid - first);
+        filter(filters, paths.data() + first, head_q, output_q.data() + first, mid - first);
+        filter(filters, paths.data() + mid, input_i.data(), output_i.data() + mid, last - mid, h);
+        filter(filters, paths.data() + mid, input_q.data(), output_q.data() + mid, last - mid, h);
+    });
+    CALL_STOP(n, output_i.size(), 3 * h * sizeof(complex<T>))
+}
+
+template <typename T, Precision R>
+void ComplexResampler<T, R>::resample(const vector<complex<T>> &input,
+                                      vector<T> &output_i, vector<T> &output_q)
+{
+    CALL_START(input.size(), output_i.size(), sizeof(complex<T>))
+    CHECK_PLANAR(output_i, output_q)
+    CHECK_SIZES(input.size(), output_i.size(), history.size())
+
+    size_t h = history.size();
+    size_t split = min<size_t>(output_i.size(), (h * P + Q - 1) / Q);
+    copy(history.begin(), history.end(), head.begin());
+    copy(input.begin(), input.begin() + h, head.begin() + h);
+    copy(input.end() - h, input.end(), history.begin());
+
+    const auto &filters = bank<accum_t>();
+    dispatch(output_i.size(), [&](size_t first, size_t last, unsigned) {
+        size_t mid = min(max(split, first), last);
+        filter(filters, paths.data() + first, head.data(),
+               output_i.data() + first, output_q.data() + first, mid - first);
+        filter(filters, paths.data() + mid, input.data(),
+               output_i.data() + mid, output_q.data() + mid, last - mid, h);
+    });
+    CALL_STOP(input.size(), output_i.size(), 3 * h * sizeof(complex<T>))
+}
+
+/*
+ * Multichannel filter loop. Channel interleaved samples are treated as 'lanes'
+ * scalars per time step, so each coefficient is loaded once and applied across
+ * a fixed width block of channels held in registers. Each output time step is
+ * handed to 'store' after accumulation.
+ */
+template <size_t W, typename A, typename X>
+static inline void filter_block(const vector<A> &h, const X *x, A *accum, size_t lanes)
+{
+    A a[W] = { };
+    for (auto hi = h.begin(); hi != h.end(); hi++, x += lanes) {
+        A coef = *hi;
+#pragma GCC unroll 16
+        for (size_t k = 0; k < W; k++)
+            a[k] += coef * (A) x[k];
+    }
+    copy(a, a + W, accum);
+}
+
+template <typename A, typename X, typename S>
+static void filter_lanes(const vector<vector<A>> &filters, const pair<size_t, unsigned> *pi,
+                         const X *x, A *accum, size_t lanes, size_t len, S store)
+{
+    for (size_t n = 0; n < len; n++, pi++) {
+        const auto &h = filters[pi->second];
+        auto xii = x + pi->first * lanes;
+        size_t k = 0;
+        for (; k + LANE_BLOCK <= lanes; k += LANE_BLOCK)
+            filter_block<LANE_BLOCK>(h, xii + k, accum + k, lanes);
+        if (k + 8 <= lanes) {
+            filter_block<8>(h, xii + k, accum + k, lanes);
+            k += 8;
+        }
+        if (k + 4 <= lanes) {
+            filter_block<4>(h, xii + k, accum + k, lanes);
+            k += 4;
+        }
+        if (k + 2 <= lanes)
+            filter_block<2>(h, xii + k, accum + k, lanes);
+        store(n, (const A *) accum);
+    }
+}
+
+template <typename T, Precision R>
+void MultiResampler<T, R>::resample(const vector<complex<T>> &input, vector<complex<T>> &output)
+{
+    CALL_START(input.size(), output.size(), sizeof(complex<T>))
+    if (input.size() % N || output.size() % N)
+        throw invalid_argument("Invalid vector size(s)");
+    CHECK_SIZES(input.size() / N, output.size() / N, history.size() / N)
+
+    size_t len = input.size() + history.size();
+    if (buffer.size() < len) buffer.resize(len);
+    complex<T> *x = buffer.data();
+    copy(history.begin(), history.end(), x);
+    copy(input.begin(), input.end(), x + history.size());
+    copy(x + len - history.size(), x + len, history.begin());
+
+    if (accum.size() < N * threads()) accum.resize(N * threads());
+
+    const auto &filters = bank<accum_t>();
+    dispatch(output.size() / N, [&](size_t first, size_t last, unsigned worker) {
+        auto out = (T *) output.data() + 2 * N * first;
+        auto store = [&](size_t n, const accum_t *a) {
+            convert(a, out + 2 * N * n, 2 * N);
+        };
+        filter_lanes(filters, paths.data() + first, (const T *) x,
+                     (accum_t *) (accum.data() + N * worker), 2 * N, last - first, store);
+    });
+    CALL_STOP(input.size(), output.size(), 2 * history.size() * sizeof(complex<T>))
+}
+
+template <typename T, Precision R>
+void MultiResampler<T, R>::resample(const vector<vector<complex<T>>> &input,
+                                    vector<vector<complex<T>>> &output)
+{
+    CALL_START(input.size() ? input[0].size() * N : 0,
+               output.size() ? output[0].size() * N : 0, sizeof(complex<T>))
+    if (input.size() != N || output.size() != N)
+        throw invalid_argument("Invalid channel count");
+    for (unsigned c = 1; c < N; c++) {
+        CHECK_PLANAR(input[c], input[0])
+        CHECK_PLANAR(output[c], output[0])
+    }
+    CHECK_SIZES(input[0].size(), output[0].size(), history.size() / N)
+
+    size_t n_in = input[0].size(), len = n_in * N + history.size();
+    if (buffer.size() < len) buffer.resize(len);
+    complex<T> *x = buffer.data();
+    copy(history.begin(), history.end(), x);
+    for (unsigned c = 0; c < N; c++)
+        for (size_t k = 0; k < n_in; k++)
+            x[history.size() + k * N + c] = input[c][k];
+    copy(x + len - history.size(), x + len, history.begin());
+
+    if (accum.size() < N * threads()) accum.resize(N * threads());
+    if (row.size() < N * threads()) row.resize(N * threads());
+
+    const auto &filters = bank<accum_t>();
+    dispatch(output[0].size(), [&](size_t first, size_t last, unsigned worker) {
+        auto r = row.data() + N * worker;
+        auto store = [&](size_t n, const accum_t *a) {
+            convert(a, (T *) r, 2 * N);
+            for (unsigned c = 0; c < N; c++)
+                output[c][first + n] = r[c];
+        };
+        filter_lanes(filters, paths.data() + first, (const T *) x,
+                     (accum_t *) (accum.data() + N * worker), 2 * N, last - first, store);
+    });
+    CALL_STOP(n_in * N, output[0].size() * N, 2 * history.size() * sizeof(complex<T>))
+}
+
+template <typename T, Precision R>
+void RealResampler<T, R>::prime(const vector<T> &input)
+{
+    PRIME_HISTORY()
+}
+
+template <typename T, Precision R>
+void RealResampler<T, R>::resample(const T *input, size_t input_len, T *output, size_t output_len)
+{
+    RESAMPLE_IN_PLACE()
+}
+
+template <typename T, Precision R>
+void RealResampler<T, R>::resample(const vector<T> &input, vector<T> &output)
+{
+    resample(input.data(), input.size(), output.data(), output.size());
+}
+
 void Resampler::resize(size_t n)
 {
+    TRACE(resize, P, Q, paths.size(), n);
     paths.resize(n);
-    unsigned i = 0;
+    uint64_t i = 0;
     for (auto &p:paths) {
-        p = pair<unsigned, unsigned>((Q * i) / P, (Q * i) % P);
+        p = pair<size_t, unsigned>((Q * i) / P, (Q * i) % P);
         i++;
     }
 }
@@ -171,6 +799,15 @@ template class ComplexResampler<long>;
 template class ComplexResampler<short>;
 template class ComplexResampler<int>;
 template class ComplexResampler<char>;
+template class ComplexResampler<float, Precision::Float>;
+
+template class MultiResampler<double>;
+template class MultiResampler<float>;
+template class MultiResampler<long>;
+template class MultiResampler<short>;
+template class MultiResampler<int>;
+template class MultiResampler<char>;
+template class MultiResampler<float, Precision::Float>;
 
 template class RealResampler<double>;
 template class RealResampler<float>;
@@ -178,3 +815,4 @@ template class RealResampler<long>;
 template class RealResampler<short>;
 template class RealResampler<int>;
 template class RealResampler<char>;
+template class RealResampler<float, Precision::Float>;
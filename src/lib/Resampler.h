@@ -3,35 +3,170 @@
 
 #include <vector>
 #include <complex>
+#include <cstdint>
+#include <memory>
+#include <atomic>
+#include <type_traits>
+
+class ThreadPool;
+
+/*
+ * Coefficient and accumulator precision. Float halves the storage and doubles
+ * the vector width of the filter loops and is available for float samples.
+ */
+enum class Precision { Double, Float };
+
+/*
+ * Polyphase partitions of the prototype filter. Banks are immutable once
+ * designed and shared between resamplers of equal rate, length and precision.
+ */
+struct Filterbank {
+    std::vector<std::vector<double>> partitions;
+    std::vector<std::vector<float>> fpartitions;
+};
+
+/*
+ * Per instance counters. Sample counts are summed over channels, and history
+ * bytes count copies into and out of the filter history and head window.
+ * Counting is compiled out of the library with --disable-stats, in which case
+ * all counters stay zero. Snapshots may be taken from any thread while another
+ * thread resamples. Each counter is read atomically, but the set is not read
+ * as one.
+ */
+struct ResamplerStats {
+    uint64_t calls;
+    uint64_t samples_in;
+    uint64_t samples_out;
+    uint64_t nanoseconds;
+    uint64_t resizes;
+    uint64_t history_bytes;
+};
 
 class Resampler {
 public:
-    Resampler(unsigned P, unsigned Q, unsigned taps);
+    Resampler(unsigned P, unsigned Q, unsigned taps, bool narrow = false);
+
+    /*
+     * Copies share the filterbank but not the thread pool, so that copies
+     * may run on different threads
+     */
+    Resampler(const Resampler &r);
+    Resampler &operator=(const Resampler &r);
+    Resampler(Resampler &&r) = default;
+    Resampler &operator=(Resampler &&r) = default;
+
+    /*
+     * Split the outputs of large blocks across 'n' threads including the
+     * caller. Output is identical to single threaded operation.
+     */
+    void set_threads(unsigned n);
+    unsigned threads() const;
+
+    unsigned taps() const { return filterbank->partitions[0].size(); }
+
+    ResamplerStats stats() const { return counters.snapshot(); }
+    void reset_stats() { counters.reset(); }
+
+    /*
+     * Return the filterbank for the given parameters, designing it only if no
+     * resampler currently holds an equal bank
+     */
+    static std::shared_ptr<const Filterbank> design(unsigned P, unsigned Q,
+                                                    unsigned taps, bool narrow);
 
 protected:
-    std::vector<std::vector<double>> partitions;
-    std::vector<std::pair<int, int>> paths;
+    std::shared_ptr<const Filterbank> filterbank;
+    /* Input offset and partition of each output */
+    std::vector<std::pair<size_t, unsigned>> paths;
+    std::shared_ptr<ThreadPool> pool;
+
+    /* Counter storage, written with relaxed atomic adds */
+    struct Counters {
+        std::atomic<uint64_t> calls, samples_in, samples_out;
+        std::atomic<uint64_t> nanoseconds, resizes, history_bytes;
+
+        Counters() { reset(); }
+        Counters(const Counters &c) { *this = c; }
+        Counters &operator=(const Counters &c);
+        ResamplerStats snapshot() const;
+        void store(const ResamplerStats &s);
+        void reset();
+    } counters;
     unsigned P, Q;
-    void init(unsigned taps, double cutoff);
     void resize(size_t n);
+    template <typename F> void dispatch(size_t len, const F &fn);
+    template <typename C> const std::vector<std::vector<C>> &bank() const;
 };
 
-template <typename T>
+template <typename T, Precision R = Precision::Double>
 class ComplexResampler : public Resampler {
 public:
     ComplexResampler(unsigned P, unsigned Q, unsigned taps = 384);
     void resample(const std::vector<std::complex<T>> &input, std::vector<std::complex<T>> &output);
+
+    /* Pointer based variant for mapped or externally owned buffers */
+    void resample(const std::complex<T> *input, size_t input_len,
+                  std::complex<T> *output, size_t output_len);
+
+    /* Planar I/Q input and output */
+    void resample(const std::vector<T> &input_i, const std::vector<T> &input_q,
+                  std::vector<T> &output_i, std::vector<T> &output_q);
+
+    /* Interleaved input with planar I/Q output */
+    void resample(const std::vector<std::complex<T>> &input,
+                  std::vector<T> &output_i, std::vector<T> &output_q);
+
+    /* Load the trailing taps-1 samples of 'input' as filter history */
+    void prime(const std::vector<std::complex<T>> &input);
 private:
+    typedef typename std::conditional<R == Precision::Float, float, double>::type accum_t;
     std::vector<std::complex<T>> history;
+    std::vector<std::complex<T>> head;
+    /* Head windows of the I and Q planes of planar input */
+    std::vector<T> planes;
 };
 
-template <typename T>
+/*
+ * Phase coherent multichannel resampler. All channels share one filterbank and
+ * path table, and each coefficient is applied across every channel in turn.
+ */
+template <typename T, Precision R = Precision::Double>
+class MultiResampler : public Resampler {
+public:
+    MultiResampler(unsigned P, unsigned Q, unsigned channels, unsigned taps = 384);
+
+    /* Channel interleaved input and output */
+    void resample(const std::vector<std::complex<T>> &input, std::vector<std::complex<T>> &output);
+
+    /* One vector per channel */
+    void resample(const std::vector<std::vector<std::complex<T>>> &input,
+                  std::vector<std::vector<std::complex<T>>> &output);
+
+    unsigned channels() const { return N; }
+private:
+    typedef typename std::conditional<R == Precision::Float, float, double>::type accum_t;
+    unsigned N;
+    std::vector<std::complex<T>> history;
+    std::vector<std::complex<T>> buffer;
+    std::vector<std::complex<accum_t>> accum;
+    std::vector<std::complex<T>> row;
+};
+
+template <typename T, Precision R = Precision::Double>
 class RealResampler : public Resampler {
 public:
     RealResampler(unsigned P, unsigned Q, unsigned taps = 128);
     void resample(const std::vector<T> &input, std::vector<T> &output);
+
+    /* Pointer based variant for mapped or externally owned buffers */
+    void resample(const T *input, size_t input_len, T *output, size_t output_len);
+
+    /* Load the trailing taps-1 samples of 'input' as filter history */
+    void prime(const std::vector<T> &input);
 private:
+    typedef typename std::conditional<R == Precision::Float, float, double>::type accum_t;
     std::vector<T> history;
+    std::vector<T> head;
 };
 
 #endif /* _RESAMPLER_H_ */
@@ -0,0 +1,88 @@
+/*
+ * Worker Thread Pool
+ *
+ * Copyright (C) 2019 Tom Tsou <tom@tsou.cc>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdexcept>
+
+#include "ThreadPool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(unsigned n)
+    : next(0)
+{
+    if (!n) throw invalid_argument("Invalid thread count");
+    for (unsigned i = 1; i < n; i++)
+        workers.emplace_back(&ThreadPool::work, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    start.notify_all();
+    for (auto &w:workers) w.join();
+}
+
+/*
+ * Indices are claimed one at a time from a shared counter, so callers should
+ * size each index as a contiguous chunk of work
+ */
+void ThreadPool::run(unsigned id)
+{
+    for (size_t i; (i = next++) < count;)
+        (*task)(i, id);
+}
+
+void ThreadPool::work(unsigned id)
+{
+    unsigned long seen = 0;
+    for (;;) {
+        {
+            unique_lock<std::mutex> lock(mutex);
+            start.wait(lock, [&] { return stop || generation != seen; });
+            if (stop) return;
+            seen = generation;
+        }
+        run(id);
+        {
+            lock_guard<std::mutex> lock(mutex);
+            if (!--active) done.notify_one();
+        }
+    }
+}
+
+void ThreadPool::parallel(size_t count, const function<void(size_t, unsigned)> &fn)
+{
+    {
+        lock_guard<std::mutex> lock(mutex);
+        task = &fn;
+        this->count = count;
+        next = 0;
+        active = workers.size();
+        generation++;
+    }
+    start.notify_all();
+    run(0);
+
+    unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return !active; });
+    task = nullptr;
+}
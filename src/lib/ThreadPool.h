@@ -0,0 +1,41 @@
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+
+/*
+ * Fixed size worker pool for data parallel loops. The calling thread takes
+ * part in each loop, so a pool of size 'n' runs 'n-1' background workers.
+ * Loops on the same pool must not be started concurrently.
+ */
+class ThreadPool {
+public:
+    ThreadPool(unsigned n);
+    ~ThreadPool();
+
+    unsigned size() const { return workers.size() + 1; }
+
+    /* Run fn(i, worker) for every i < count and wait for completion */
+    void parallel(size_t count, const std::function<void(size_t, unsigned)> &fn);
+
+private:
+    void work(unsigned id);
+    void run(unsigned id);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start, done;
+    const std::function<void(size_t, unsigned)> *task = nullptr;
+    std::atomic<size_t> next;
+    size_t count = 0;
+    unsigned active = 0;
+    unsigned long generation = 0;
+    bool stop = false;
+};
+
+#endif /* _THREADPOOL_H_ */
@@ -17,22 +17,112 @@
 
 #include <unistd.h>
 #include <getopt.h>
+#include <glob.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <exception>
 #include <complex>
 #include <vector>
+#include <chrono>
+#include <algorithm>
 #include "Resampler.h"
+#include "ThreadPool.h"
+#include "RingBuffer.h"
+#include "FileIO.h"
 
 #define BLOCKSIZE   4096
 
+/*
+ * Autotuning limits. Candidate block sizes are capped to bound ring memory,
+ * and each candidate is timed for at least TUNE_TIME seconds.
+ */
+#define TUNE_MAX    (1 << 20)
+#define TUNE_TIME   0.1
+
+/*
+ * Approximate input bytes per work unit in threaded file mode
+ */
+#define SEGMENTSIZE (64 << 20)
+
+/*
+ * Approximate input bytes per resampler call in mapped file mode
+ */
+#define MAPSIZE     (4 << 20)
+
+/*
+ * Blocks in flight between each pair of pipeline stages
+ */
+#define RING_BLOCKS 16
+
+/*
+ * Server limits. Requests are single lines with up to two passed descriptors,
+ * and prototype resamplers are kept for this many distinct parameter sets.
+ * Reduced rate numerators and denominators are bounded, as the filterbank of
+ * each request holds P partitions.
+ */
+#define REQUEST_MAX 4096
+#define WARM_MAX    64
+#define RATE_MAX    4096
+
 using namespace std;
 
 struct resample_args {
     string infile;
     string outfile;
+    string manifest;
+    string pattern;
+    string outdir;
+    string serve;
+    string client;
     string type = "fc32";
     unsigned p, q;
+    unsigned threads = 1;
+    size_t block_size = BLOCKSIZE;
+    bool autotune = false;
+    bool mmap = false;
+    bool uring = false;
+    bool stats = false;
+    bool progress = false;
+};
+
+/*
+ * Run statistics. Stage times are the busy times of each stage, which overlap
+ * in streaming mode. Latencies are per resampler call and are only recorded
+ * with --stats.
+ */
+struct Stats {
+    size_t n_in = 0, n_out = 0;
+    double start = 0.0, last = 0.0;
+    double read = 0.0, resample = 0.0, write = 0.0;
+    vector<double> latency;
+    ResamplerStats lib = ResamplerStats();
+};
+
+static double now()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <typename S>
+struct Block {
+    Block(size_t n = 0) : samples(n), last(false) { }
+    vector<S> samples;
+    bool last;
 };
 
 static std::map<string, pair<string, size_t>> sample_type_map {
@@ -54,11 +144,23 @@ static void print_help()
 {
     fprintf(stdout, "Options:\n"
             "  -h, --help         This text\n"
-            "  -i, --ifile        Input file\n"
-            "  -o, --ofile        Output file\n"
+            "  -i, --ifile        Input file, '-' for stdin or 'shm:NAME' for a shared ring\n"
+            "  -o, --ofile        Output file, '-' for stdout or 'shm:NAME' for a shared ring\n"
             "  -p, --numerator    Rational rate numerator 'P'\n"
             "  -q, --denominator  Rational rate denominator 'Q'\n"
             "  -t, --sampletype   Sample type (default=fc32)\n"
+            "  -B, --batch        Convert the 'input output' file pairs listed in a manifest\n"
+            "  -g, --glob         Convert files matching a pattern into the output directory\n"
+            "  -d, --outdir       Output directory for --glob\n"
+            "  -S, --serve        Serve resample jobs on a Unix socket\n"
+            "  -C, --client       Submit the job to a server on a Unix socket\n"
+            "  -b, --block-size   Input bytes per resampler call (default=4096)\n"
+            "  -a, --autotune     Benchmark block sizes and use the fastest\n"
+            "  -j, --threads      Resample file segments or batch files on 'N' threads (default=1)\n"
+            "  -m, --mmap         Resample memory mapped files in place\n"
+            "  -u, --io-uring     Use asynchronous io_uring file I/O\n"
+            "  -s, --stats        Report throughput and timing statistics\n"
+            "  -r, --progress     Print progress to stderr every second\n"
             );
     fprintf(stdout, "\nSample Types:\n");
     for (auto p:sample_type_map)
@@ -71,11 +173,64 @@ static void print_done(size_t num, size_t bytes, string file, string type)
          << bytes << " bytes) to file " << file << endl;
 }
 
+/*
+ * Report output progress at most once per second
+ */
+static void print_progress(const resample_args &args, Stats &stats)
+{
+    double t = now();
+    if (!args.progress || t - stats.last < 1.0) return;
+    stats.last = t;
+    cerr << "Progress: " << stats.n_out << " samples written, "
+         << stats.n_out / (t - stats.start) / 1e6 << " Msps" << endl;
+}
+
+static void print_stats(const resample_args &args, Stats &stats)
+{
+    double wall = now() - stats.start;
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    double cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+                 (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+    size_t type_sz = sample_type_map[args.type].second;
+
+    cout << "Wall time " << wall << " s, CPU time " << cpu << " s" << endl;
+    cout << "Input " << stats.n_in / wall / 1e6 << " Msps ("
+         << stats.n_in * type_sz / wall / 1e6 << " MB/s), output "
+         << stats.n_out / wall / 1e6 << " Msps ("
+         << stats.n_out * type_sz / wall / 1e6 << " MB/s)" << endl;
+    if (stats.read > 0.0 || stats.write > 0.0)
+        cout << "Busy read " << 100 * stats.read / wall << "%, resample "
+             << 100 * stats.resample / wall << "%, write "
+             << 100 * stats.write / wall << "%" << endl;
+
+    if (stats.lib.calls)
+        cout << "Resampler " << stats.lib.calls << " calls, "
+             << stats.lib.nanoseconds / 1e3 / stats.lib.calls << " us per call, "
+             << stats.lib.resizes << " resizes, "
+             << stats.lib.history_bytes << " history bytes copied" << endl;
+
+    auto &l = stats.latency;
+    if (l.empty()) return;
+    sort(l.begin(), l.end());
+    cout << "Block latency p50 " << l[l.size() / 2] * 1e6 << " us, p99 "
+         << l[min(l.size() - 1, l.size() * 99 / 100)] * 1e6 << " us, max "
+         << l.back() * 1e6 << " us (" << l.size() << " blocks)" << endl;
+}
+
 static void print_version()
 {
     fprintf(stdout, "resample version-0.1\n");
 }
 
+/*
+ * Standard streams and shared rings are only read or written in order
+ */
+static bool is_stream(const string &path)
+{
+    return path == "-" || !path.compare(0, 4, "shm:");
+}
+
 static bool handle_options(int argc, char **argv, resample_args &args)
 {
     int option;
@@ -87,8 +242,21 @@ static bool handle_options(int argc, char **argv, resample_args &args)
         { "numerator", 1, 0, 'p' },
         { "denominator", 1, 0, 'q' },
         { "sampletype", 2, 0, 't' },
+        { "batch", 1, 0, 'B' },
+        { "glob", 1, 0, 'g' },
+        { "outdir", 1, 0, 'd' },
+        { "serve", 1, 0, 'S' },
+        { "client", 1, 0, 'C' },
+        { "block-size", 1, 0, 'b' },
+        { "autotune", 0, 0, 'a' },
+        { "threads", 1, 0, 'j' },
+        { "mmap", 0, 0, 'm' },
+        { "io-uring", 0, 0, 'u' },
+        { "stats", 0, 0, 's' },
+        { "progress", 0, 0, 'r' },
+        { 0, 0, 0, 0 },
     };
-    while ((option = getopt_long(argc, argv, "hvi:o:p:q:t:", long_options, NULL)) != -1) {
+    while ((option = getopt_long(argc, argv, "hvi:o:p:q:t:B:g:d:S:C:b:aj:musr", long_options, NULL)) != -1) {
         switch (option) {
         case 'h':
                 print_help();
@@ -111,92 +279,982 @@ static bool handle_options(int argc, char **argv, resample_args &args)
         case 't':
                 args.type = string(optarg);
                 break;
+        case 'B':
+                args.manifest = string(optarg);
+                break;
+        case 'g':
+                args.pattern = string(optarg);
+                break;
+        case 'd':
+                args.outdir = string(optarg);
+                break;
+        case 'S':
+                args.serve = string(optarg);
+                break;
+        case 'C':
+                args.client = string(optarg);
+                break;
+        case 'b':
+                args.block_size = atol(optarg);
+                break;
+        case 'a':
+                args.autotune = true;
+                break;
+        case 'j':
+                args.threads = atoi(optarg);
+                break;
+        case 'm':
+                args.mmap = true;
+                break;
+        case 'u':
+                args.uring = true;
+                break;
+        case 's':
+                args.stats = true;
+                break;
+        case 'r':
+                args.progress = true;
+                break;
         };
     }
 
-    if (args.infile.empty() || args.outfile.empty() || !args.p || !args.q) {
+    /* Served jobs carry their own files and parameters */
+    if (!args.serve.empty()) return true;
+
+    bool batch = !args.manifest.empty() || !args.pattern.empty();
+    if ((!batch && (args.infile.empty() || args.outfile.empty())) ||
+        !args.p || !args.q || !args.threads || !args.block_size) {
         print_help();
         return false;
     }
+    if (batch && (!args.infile.empty() || !args.outfile.empty() || args.mmap ||
+                  (!args.manifest.empty() && !args.pattern.empty()) ||
+                  (!args.pattern.empty() && args.outdir.empty()))) {
+        cout << "Batch mode takes either a manifest or a pattern with an output directory" << endl;
+        return false;
+    }
     if (!sample_type_map.count(args.type)) {
         cout << "Unknown sample type " << args.type << endl;
         print_help();
         return false;
     }
+    if (!args.client.empty() && (batch || args.mmap || args.threads > 1)) {
+        cout << "Client mode submits a single streaming job" << endl;
+        return false;
+    }
+    if ((args.mmap || args.threads > 1) && (is_stream(args.infile) || is_stream(args.outfile))) {
+        cout << "Mapped and threaded modes require regular files" << endl;
+        return false;
+    }
     return true;
 }
 
-#define RUN_COMPLEX_RESAMPLER(T) \
-    try { \
-        run_resampler(ComplexResampler<T>(args.p, args.q), \
-                      vector<complex<T>>(n_blks*args.q), vector<complex<T>>(n_blks*args.p)); \
-    } catch (exception &e) { \
-        cout << e.what() << endl; \
+/*
+ * Call 'run' with a resampler and an empty sample vector of the selected type
+ */
+template <typename F>
+static void dispatch_type(const resample_args &args, F run)
+{
+    if      (args.type == "fc64") run(ComplexResampler<double>(args.p, args.q), vector<complex<double>>());
+    else if (args.type == "fc32") run(ComplexResampler<float>(args.p, args.q), vector<complex<float>>());
+    else if (args.type == "sc64") run(ComplexResampler<long>(args.p, args.q), vector<complex<long>>());
+    else if (args.type == "sc32") run(ComplexResampler<int>(args.p, args.q), vector<complex<int>>());
+    else if (args.type == "sc16") run(ComplexResampler<short>(args.p, args.q), vector<complex<short>>());
+    else if (args.type ==  "sc8") run(ComplexResampler<char>(args.p, args.q), vector<complex<char>>());
+    else if (args.type ==  "f64") run(RealResampler<double>(args.p, args.q), vector<double>());
+    else if (args.type ==  "f32") run(RealResampler<float>(args.p, args.q), vector<float>());
+    else if (args.type ==  "s64") run(RealResampler<long>(args.p, args.q), vector<long>());
+    else if (args.type ==  "s32") run(RealResampler<int>(args.p, args.q), vector<int>());
+    else if (args.type ==  "s16") run(RealResampler<short>(args.p, args.q), vector<short>());
+    else if (args.type ==   "s8") run(RealResampler<char>(args.p, args.q), vector<char>());
+}
+
+/*
+ * Block length in samples. Blocks must cover at least the filter history.
+ */
+template <typename R>
+static size_t block_len(const R &resampler, const resample_args &args)
+{
+    size_t blk_sz = sample_type_map.at(args.type).second * args.q;
+    size_t n_blks = blk_sz > args.block_size ? 1 : args.block_size / blk_sz;
+    size_t min_blks = (resampler.taps() - 1 + args.q - 1) / args.q;
+    return max(n_blks, min_blks) * args.q;
+}
+
+/*
+ * Data and unified cache sizes in bytes reported by sysfs for the first CPU
+ */
+static vector<size_t> cache_sizes()
+{
+    vector<size_t> sizes;
+    for (int i = 0;; i++) {
+        string dir = "/sys/devices/system/cpu/cpu0/cache/index" + to_string(i) + "/";
+        ifstream type(dir + "type"), size(dir + "size");
+        string t, unit;
+        size_t n = 0;
+        if (!(type >> t) || !(size >> n)) break;
+        if (t == "Instruction") continue;
+        size >> unit;
+        if (unit == "K") n <<= 10;
+        else if (unit == "M") n <<= 20;
+        sizes.push_back(n);
     }
+    return sizes;
+}
 
-#define RUN_REAL_RESAMPLER(T) \
-    try { \
-        run_resampler(RealResampler<T>(args.p, args.q), \
-                      vector<T>(n_blks*args.q), vector<T>(n_blks*args.p)); \
-    } catch (exception &e) { \
-        cout << e.what() << endl; \
+/*
+ * Time resampling of zeroed blocks for the default block size and for half of
+ * each cache level, so that input and output blocks fit in that level, and
+ * return the fastest size in bytes.
+ */
+static size_t autotune(const resample_args &args)
+{
+    vector<size_t> sizes { BLOCKSIZE };
+    for (auto n : cache_sizes())
+        if (n / 2 <= TUNE_MAX) sizes.push_back(n / 2);
+    sizes.push_back(TUNE_MAX);
+    sort(sizes.begin(), sizes.end());
+    sizes.erase(unique(sizes.begin(), sizes.end()), sizes.end());
+
+    size_t best = BLOCKSIZE;
+    double best_rate = 0.0;
+
+    auto run_resampler = [&](auto resampler, auto proto) {
+        for (auto size : sizes) {
+            resample_args tune_args = args;
+            tune_args.block_size = size;
+            size_t blk_len = block_len(resampler, tune_args);
+            auto r = resampler;
+            auto input = proto, output = proto;
+            input.resize(blk_len);
+            output.resize(blk_len / args.q * args.p);
+
+            r.resample(input, output);
+            auto start = chrono::steady_clock::now();
+            chrono::duration<double> elapsed;
+            size_t n_calls = 0;
+            do {
+                r.resample(input, output);
+                elapsed = chrono::steady_clock::now() - start;
+                n_calls++;
+            } while (elapsed.count() < TUNE_TIME);
+
+            double rate = n_calls * blk_len / elapsed.count();
+            cout << "  block size " << size << " bytes: " << rate / 1e6 << " Msps" << endl;
+            if (rate > best_rate) {
+                best_rate = rate;
+                best = size;
+            }
+        }
+    };
+    dispatch_type(args, run_resampler);
+    return best;
+}
+
+/*
+ * Input samples used from a file of 'n' samples, whole multiples of Q. A
+ * trailing block shorter than the filter history is resampled with the block
+ * before it, so the output length does not depend on the block size. Only a
+ * file shorter than the filter history gives no output.
+ */
+static size_t file_samples(size_t n, size_t hist, unsigned q)
+{
+    n = n / q * q;
+    return n < hist ? 0 : n;
+}
+
+static bool open_files(const resample_args &args, int &ifd, int &ofd, int oflags)
+{
+    ifd = open(args.infile.c_str(), O_RDONLY);
+    if (ifd < 0) {
+        cout << "Failed to open input file " << args.infile << endl;
+        return false;
+    }
+    ofd = open(args.outfile.c_str(), oflags | O_CREAT | O_TRUNC, 0644);
+    if (ofd < 0) {
+        cout << "Failed to open output file " << args.outfile << endl;
+        close(ifd);
+        return false;
+    }
+    return true;
+}
+
+static bool pread_full(int fd, void *buf, size_t len, off_t offset)
+{
+    for (char *p = (char *) buf; len;) {
+        ssize_t n = pread(fd, p, len, offset);
+        if (n <= 0) return false;
+        p += n, len -= n, offset += n;
     }
+    return true;
+}
+
+static bool pwrite_full(int fd, const void *buf, size_t len, off_t offset)
+{
+    for (const char *p = (const char *) buf; len;) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n <= 0) return false;
+        p += n, len -= n, offset += n;
+    }
+    return true;
+}
+
+/*
+ * Threaded file mode. The input is split into segments of whole blocks, so
+ * block boundaries match the serial run. Each worker primes its resampler with
+ * the taps-1 input samples preceding the segment and writes the output to its
+ * final file offset.
+ */
+static bool run_threaded(const resample_args &args, Stats &stats)
+{
+    int ifd, ofd;
+    if (!open_files(args, ifd, ofd, O_WRONLY)) return false;
+
+    struct stat st;
+    fstat(ifd, &st);
+
+    size_t type_sz = sample_type_map[args.type].second;
+
+    mutex err_mutex;
+    string err;
+
+    auto run_resampler = [&](auto resampler, auto proto) {
+        typedef typename decltype(proto)::value_type S;
+
+        size_t hist = resampler.taps() - 1;
+        size_t blk_len = block_len(resampler, args);
+        size_t seg_len = max<size_t>(1, SEGMENTSIZE / (blk_len * type_sz)) * blk_len;
+        size_t n_in = file_samples(st.st_size / type_sz, hist, args.q);
+        stats.n_in = n_in;
+        stats.n_out = n_in / args.q * args.p;
+        if (ftruncate(ofd, stats.n_out * type_sz) < 0) {
+            err = strerror(errno);
+            return;
+        }
+
+        ThreadPool pool(args.threads);
+        vector<decltype(resampler)> resamplers(pool.size(), resampler);
+        size_t n_segs = (n_in + seg_len - 1) / seg_len;
+        if (n_segs > 1 && n_in - (n_segs - 1) * seg_len < hist) n_segs--;
+
+        pool.parallel(n_segs, [&](size_t seg, unsigned worker) {
+            auto &r = resamplers[worker];
+            size_t first = seg * seg_len;
+            size_t last = seg + 1 == n_segs ? n_in : first + seg_len;
+            vector<S> input(hist), output;
+
+            try {
+                {
+                    lock_guard<mutex> lock(err_mutex);
+                    if (!err.empty()) return;
+                }
+                size_t n = min(hist, first);
+                if (!pread_full(ifd, &input[hist - n], n * type_sz, (first - n) * type_sz))
+                    throw runtime_error("Failed to read input file " + args.infile);
+                r.prime(input);
+
+                for (size_t pos = first, len; pos < last; pos += len) {
+                    len = min(blk_len, last - pos);
+                    if (last - pos - len < hist) len = last - pos;
+                    input.resize(len);
+                    output.resize(len / args.q * args.p);
+                    if (!pread_full(ifd, input.data(), len * type_sz, pos * type_sz))
+                        throw runtime_error("Failed to read input file " + args.infile);
+                    r.resample(input, output);
+                    if (!pwrite_full(ofd, output.data(), output.size() * type_sz,
+                                     pos / args.q * args.p * type_sz))
+                        throw runtime_error("Failed to write output file " + args.outfile);
+                }
+            } catch (exception &e) {
+                lock_guard<mutex> lock(err_mutex);
+                if (err.empty()) err = e.what();
+            }
+        });
+    };
+
+    try {
+        dispatch_type(args, run_resampler);
+    } catch (exception &e) {
+        err = e.what();
+    }
+
+    close(ifd);
+    close(ofd);
+    if (!err.empty()) {
+        cout << err << endl;
+        return false;
+    }
+    return true;
+}
+
+struct Mapping {
+    Mapping(int fd, size_t len, int prot) : len(len)
+    {
+        addr = len ? mmap(NULL, len, prot, MAP_SHARED, fd, 0) : NULL;
+        if (addr == MAP_FAILED)
+            throw runtime_error(string("Failed to map file: ") + strerror(errno));
+        if (!addr) return;
+        madvise(addr, len, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+        madvise(addr, len, MADV_HUGEPAGE);
+#endif
+    }
+    ~Mapping() { if (addr) munmap(addr, len); }
+
+    void *addr;
+    size_t len;
+};
+
+/*
+ * Mapped file mode. Both files are mapped and the resampler runs directly on
+ * the mapped regions, in calls of whole blocks, with no intermediate buffers.
+ * Threads, if requested, split the outputs of each call.
+ */
+static bool run_mapped(const resample_args &args, Stats &stats)
+{
+    int ifd, ofd;
+    if (!open_files(args, ifd, ofd, O_RDWR)) return false;
+
+    struct stat st;
+    fstat(ifd, &st);
+
+    size_t type_sz = sample_type_map[args.type].second;
+
+    auto run_resampler = [&](auto resampler, auto proto) {
+        typedef typename decltype(proto)::value_type S;
+
+        size_t blk_len = block_len(resampler, args);
+        size_t map_len = max<size_t>(1, MAPSIZE / (blk_len * type_sz)) * blk_len;
+        size_t hist = resampler.taps() - 1;
+        size_t n_in = file_samples(st.st_size / type_sz, hist, args.q);
+        size_t n_out = n_in / args.q * args.p;
+        if (ftruncate(ofd, n_out * type_sz) < 0)
+            throw runtime_error(string("Failed to size output file: ") + strerror(errno));
+
+        Mapping in(ifd, n_in * type_sz, PROT_READ);
+        Mapping out(ofd, n_out * type_sz, PROT_READ | PROT_WRITE);
+        resampler.set_threads(args.threads);
+
+        for (size_t pos = 0, len; pos < n_in; pos += len) {
+            len = min(map_len, n_in - pos);
+            if (n_in - pos - len < hist) len = n_in - pos;
+            double t = now();
+            resampler.resample((const S *) in.addr + pos, len,
+                               (S *) out.addr + pos / args.q * args.p, len / args.q * args.p);
+            t = now() - t;
+            stats.resample += t;
+            if (args.stats) stats.latency.push_back(t);
+            stats.n_in += len;
+            stats.n_out += len / args.q * args.p;
+            print_progress(args, stats);
+        }
+        stats.lib = resampler.stats();
+    };
+
+    bool ok = true;
+    try {
+        dispatch_type(args, run_resampler);
+    } catch (exception &e) {
+        cout << e.what() << endl;
+        ok = false;
+    }
+
+    close(ifd);
+    close(ofd);
+    return ok;
+}
+
+/*
+ * Streaming mode. Reader, resampler and writer stages are connected by rings
+ * of preallocated blocks, so I/O overlaps with filtering. The resampler stage
+ * runs on the calling thread. A block marked 'last' ends the stream. The reader
+ * looks ahead by the filter history, so that a final partial block too short
+ * to resample on its own joins the block before it. On error the
+ * stages are aborted, blocks already resampled are still written, and the
+ * first error is rethrown.
+ */
+static void run_stream(const resample_args &args, Source &source, Sink &sink, Stats &stats)
+{
+    size_t type_sz = sample_type_map[args.type].second;
+
+    auto run_resampler = [&](auto resampler, auto proto) {
+        typedef typename decltype(proto)::value_type S;
+        typedef Block<S> B;
+
+        size_t blk_len = block_len(resampler, args);
+        size_t hist = resampler.taps() - 1;
+        size_t ahead_len = (hist + args.q - 1) / args.q * args.q;
+        RingBuffer<B> in_ring(RING_BLOCKS, B(blk_len + ahead_len));
+        RingBuffer<B> out_ring(RING_BLOCKS, B((blk_len + ahead_len) / args.q * args.p));
+        atomic<bool> abort(false), never(false);
+        exception_ptr rd_err, rs_err, wr_err;
+
+        /*
+         * Each block starts with the samples read ahead for it. Sources fill
+         * every read until the end of input, so a short read marks the end.
+         */
+        thread reader([&] {
+            vector<S> ahead(ahead_len);
+            size_t n_ahead = 0;
+            bool eof = false;
+            try {
+                while (in_ring.wait_back(abort)) {
+                    auto &blk = in_ring.back();
+                    blk.samples.resize(blk_len + ahead_len);
+                    S *x = blk.samples.data();
+                    copy(ahead.begin(), ahead.begin() + n_ahead, x);
+                    size_t n = n_ahead;
+                    n_ahead = 0;
+
+                    double t = now();
+                    if (!eof) {
+                        size_t len = (blk_len - n) * type_sz;
+                        size_t n_rd = source.read(x + n, len);
+                        n += n_rd / type_sz;
+                        eof = n_rd < len;
+                    }
+                    if (!eof) {
+                        size_t len = ahead_len * type_sz;
+                        size_t n_rd = source.read(ahead.data(), len);
+                        n_ahead = n_rd / type_sz;
+                        eof = n_rd < len;
+                        if (eof && n_ahead / args.q * args.q < hist) {
+                            copy(ahead.begin(), ahead.begin() + n_ahead, x + n);
+                            n += n_ahead;
+                            n_ahead = 0;
+                        }
+                    }
+                    stats.read += now() - t;
+
+                    n = n / args.q * args.q;
+                    blk.samples.resize(n);
+                    blk.last = !n || n < hist;
+                    if (!blk.last) stats.n_in += n;
+                    in_ring.push();
+                    if (blk.last) break;
+                }
+            } catch (...) {
+                rd_err = current_exception();
+                abort = true;
+            }
+        });
+
+        thread writer([&] {
+            while (out_ring.wait_front(never)) {
+                auto &blk = out_ring.front();
+                if (blk.last) break;
+                try {
+                    if (!wr_err) {
+                        double t = now();
+                        sink.write(blk.samples.data(), blk.samples.size() * type_sz);
+                        stats.write += now() - t;
+                        stats.n_out += blk.samples.size();
+                        print_progress(args, stats);
+                    }
+                } catch (...) {
+                    wr_err = current_exception();
+                    abort = true;
+                }
+                out_ring.pop();
+            }
+        });
+
+        for (bool last = false; !last;) {
+            bool ready = in_ring.wait_front(abort);
+            out_ring.wait_back(never);
+            auto &out = out_ring.back();
+            last = !ready || in_ring.front().last;
+            try {
+                if (!last) {
+                    auto &in = in_ring.front();
+                    out.samples.resize(in.samples.size() / args.q * args.p);
+                    double t = now();
+                    resampler.resample(in.samples, out.samples);
+                    t = now() - t;
+                    stats.resample += t;
+                    if (args.stats) stats.latency.push_back(t);
+                }
+            } catch (...) {
+                rs_err = current_exception();
+                abort = last = true;
+            }
+            out.last = last;
+            if (ready) in_ring.pop();
+            out_ring.push();
+        }
+
+        reader.join();
+        writer.join();
+        stats.lib = resampler.stats();
+        if (rd_err) rethrow_exception(rd_err);
+        if (rs_err) rethrow_exception(rs_err);
+        if (wr_err) rethrow_exception(wr_err);
+    };
+
+    try {
+        dispatch_type(args, run_resampler);
+    } catch (...) {
+        try {
+            sink.finish();
+        } catch (...) { }
+        throw;
+    }
+    sink.finish();
+}
+
+/*
+ * Open the source and sink of a streaming run that are not already set
+ */
+static void open_stream(const resample_args &args, unique_ptr<Source> &source, unique_ptr<Sink> &sink)
+{
+    if (!source && args.infile == "-") source = unique_ptr<Source>(new FdSource(STDIN_FILENO));
+    if (!sink && args.outfile == "-") sink = unique_ptr<Sink>(new FdSink(STDOUT_FILENO));
+    if (!source && !args.infile.compare(0, 4, "shm:")) source = shm_source(args.infile.substr(4));
+    if (!sink && !args.outfile.compare(0, 4, "shm:")) sink = shm_sink(args.outfile.substr(4));
+    if (args.uring && !source) {
+        source = uring_source(args.infile);
+        if (!source) cout << "io_uring unavailable, using buffered input" << endl;
+    }
+    if (args.uring && !sink) {
+        sink = uring_sink(args.outfile);
+        if (!sink) cout << "io_uring unavailable, using buffered output" << endl;
+    }
+    if (!source) source = unique_ptr<Source>(new StreamSource(args.infile));
+    if (!sink) sink = unique_ptr<Sink>(new StreamSink(args.outfile));
+}
+
+struct Job {
+    string infile;
+    string outfile;
+    Stats stats;
+    double time = 0.0;
+    string err;
+};
+
+/*
+ * Batch file pairs from a manifest of whitespace separated 'input output'
+ * lines, with '#' comments, or from the files matching a glob pattern
+ */
+/*
+ * Identity of a path independent of its spelling, the device and inode of its
+ * directory and its final component, so that output files that do not exist
+ * yet can be compared
+ */
+static string path_id(const string &path)
+{
+    size_t slash = path.find_last_of('/');
+    string dir = slash == string::npos ? "." : path.substr(0, slash + 1);
+    struct stat st;
+    if (stat(dir.c_str(), &st)) return path;
+    return to_string(st.st_dev) + ":" + to_string(st.st_ino) + "/" + path.substr(slash + 1);
+}
+
+static string inode_id(const string &path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st)) return "";
+    return to_string(st.st_dev) + ":" + to_string(st.st_ino);
+}
+
+/*
+ * Reject jobs that would truncate an input, including through links, or
+ * write one output from two workers
+ */
+static bool check_jobs(const vector<Job> &jobs)
+{
+    set<string> inputs, outputs;
+    for (auto &job:jobs) {
+        inputs.insert(path_id(job.infile));
+        inputs.insert(inode_id(job.infile));
+    }
+    inputs.erase("");
+
+    for (auto &job:jobs) {
+        string out = inode_id(job.outfile);
+        if (inputs.count(path_id(job.outfile)) || (!out.empty() && inputs.count(out))) {
+            cout << "Output file " << job.outfile << " is also an input" << endl;
+            return false;
+        }
+        if (!outputs.insert(path_id(job.outfile)).second) {
+            cout << "Duplicate output file " << job.outfile << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool batch_jobs(const resample_args &args, vector<Job> &jobs)
+{
+    if (!args.manifest.empty()) {
+        ifstream manifest(args.manifest);
+        if (!manifest) {
+            cout << "Failed to open manifest " << args.manifest << endl;
+            return false;
+        }
+        string line;
+        while (getline(manifest, line)) {
+            istringstream ss(line);
+            Job job;
+            if (!(ss >> job.infile) || job.infile[0] == '#') continue;
+            if (!(ss >> job.outfile)) {
+                cout << "Missing output file for " << job.infile << endl;
+                return false;
+            }
+            jobs.push_back(job);
+        }
+        return check_jobs(jobs);
+    }
+
+    glob_t g;
+    if (glob(args.pattern.c_str(), 0, NULL, &g)) {
+        cout << "No files match " << args.pattern << endl;
+        return false;
+    }
+    for (size_t i = 0; i < g.gl_pathc; i++) {
+        Job job;
+        job.infile = g.gl_pathv[i];
+        job.outfile = args.outdir + "/" + job.infile.substr(job.infile.find_last_of('/') + 1);
+        jobs.push_back(job);
+    }
+    globfree(&g);
+    return check_jobs(jobs);
+}
+
+/*
+ * Batch mode. Files are streamed independently by a pool of workers. A
+ * prototype resampler is held for the whole batch, so every job finds its
+ * filterbank in the library cache instead of designing it again.
+ */
+static bool run_batch(const resample_args &args)
+{
+    vector<Job> jobs;
+    if (!batch_jobs(args, jobs)) return false;
+
+    shared_ptr<void> proto;
+    try {
+        dispatch_type(args, [&](auto resampler, auto) {
+            proto = make_shared<decltype(resampler)>(resampler);
+        });
+    } catch (exception &e) {
+        cout << e.what() << endl;
+        return false;
+    }
+
+    double start = now();
+    ThreadPool pool(args.threads);
+    pool.parallel(jobs.size(), [&](size_t i, unsigned) {
+        auto &job = jobs[i];
+        resample_args job_args = args;
+        job_args.infile = job.infile;
+        job_args.outfile = job.outfile;
+        job.stats.start = job.stats.last = now();
+        try {
+            unique_ptr<Source> source;
+            unique_ptr<Sink> sink;
+            open_stream(job_args, source, sink);
+            run_stream(job_args, *source, *sink, job.stats);
+        } catch (exception &e) {
+            job.err = e.what();
+        }
+        job.time = now() - job.stats.start;
+    });
+    double time = now() - start;
+
+    size_t type_sz = sample_type_map[args.type].second;
+    size_t n_in = 0, n_failed = 0;
+    for (auto &job : jobs) {
+        cout << job.infile << " -> " << job.outfile << ": ";
+        if (!job.err.empty()) {
+            cout << "failed, " << job.err << endl;
+            n_failed++;
+            continue;
+        }
+        cout << job.stats.n_out << " samples in " << job.time << " s, "
+             << job.stats.n_in / job.time / 1e6 << " Msps" << endl;
+        n_in += job.stats.n_in;
+    }
+    cout << "Converted " << jobs.size() - n_failed << " of " << jobs.size() << " files, "
+         << n_in << " input samples in " << time << " s, " << n_in / time / 1e6
+         << " Msps (" << n_in * type_sz / time / 1e6 << " MB/s)" << endl;
+    return !n_failed;
+}
+
+/*
+ * Server mode. Each connection carries one job as a request line
+ *
+ *   <type> <p> <q> <input> <output>
+ *
+ * where '-' for a file selects the next descriptor passed with SCM_RIGHTS,
+ * in order. The reply is "OK <samples>" or "ERR <message>". Jobs run
+ * concurrently on a thread per connection, and a prototype resampler is held
+ * for each parameter set so later jobs reuse the cached filterbank.
+ */
+static bool recv_request(int fd, string &line, vector<int> &fds)
+{
+    char buf[REQUEST_MAX];
+    char ctrl[CMSG_SPACE(2 * sizeof(int))];
+    struct iovec iov = { buf, sizeof(buf) };
+    struct msghdr msg = { };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0) return false;
+    for (auto c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+        size_t k = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < k; i++) {
+            int passed;
+            memcpy(&passed, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+            fds.push_back(passed);
+        }
+    }
+
+    line.assign(buf, n);
+    while (line.find('\n') == string::npos) {
+        if (line.size() >= REQUEST_MAX) return false;
+        n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) return false;
+        line.append(buf, n);
+    }
+    line.resize(line.find('\n'));
+    return true;
+}
+
+static void send_reply(int fd, const string &reply)
+{
+    string line = reply + "\n";
+    send(fd, line.data(), line.size(), MSG_NOSIGNAL);
+}
+
+static unsigned gcd(unsigned a, unsigned b)
+{
+    while (b) {
+        unsigned t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+struct WarmCache {
+    mutex lock;
+    map<string, shared_ptr<void>> protos;
+};
+
+static void serve_job(const resample_args &args, WarmCache &warm, int fd)
+{
+    string line;
+    vector<int> fds;
+    size_t next_fd = 0;
+    resample_args job_args = args;
+    unique_ptr<Source> source;
+    unique_ptr<Sink> sink;
+
+    try {
+        if (!recv_request(fd, line, fds))
+            throw runtime_error("Invalid request");
+        istringstream ss(line);
+        if (!(ss >> job_args.type >> job_args.p >> job_args.q >> job_args.infile >> job_args.outfile) ||
+            !sample_type_map.count(job_args.type) || !job_args.p || !job_args.q)
+            throw invalid_argument("Invalid request: " + line);
+        unsigned g = gcd(job_args.p, job_args.q);
+        job_args.p /= g;
+        job_args.q /= g;
+        if (job_args.p > RATE_MAX || job_args.q > RATE_MAX)
+            throw invalid_argument("Rate ratio exceeds " + to_string(RATE_MAX));
+
+        if (job_args.infile == "-") {
+            if (next_fd == fds.size()) throw invalid_argument("Missing input descriptor");
+            source = unique_ptr<Source>(new FdSource(fds[next_fd++]));
+        }
+        if (job_args.outfile == "-") {
+            if (next_fd == fds.size()) throw invalid_argument("Missing output descriptor");
+            sink = unique_ptr<Sink>(new FdSink(fds[next_fd++]));
+        }
+
+        /* Filterbanks are designed outside the lock so that other jobs may start */
+        string key = job_args.type + " " + to_string(job_args.p) + "/" + to_string(job_args.q);
+        bool warmed;
+        {
+            lock_guard<mutex> guard(warm.lock);
+            warmed = warm.protos.count(key);
+        }
+        if (!warmed) {
+            shared_ptr<void> proto;
+            dispatch_type(job_args, [&](auto resampler, auto) {
+                proto = make_shared<decltype(resampler)>(resampler);
+            });
+            lock_guard<mutex> guard(warm.lock);
+            if (warm.protos.size() >= WARM_MAX) warm.protos.clear();
+            warm.protos.emplace(key, proto);
+        }
+
+        Stats stats;
+        stats.start = stats.last = now();
+        open_stream(job_args, source, sink);
+        run_stream(job_args, *source, *sink, stats);
+        send_reply(fd, "OK " + to_string(stats.n_out));
+    } catch (exception &e) {
+        send_reply(fd, string("ERR ") + e.what());
+    }
+
+    for (auto passed : fds) close(passed);
+    close(fd);
+}
+
+static sockaddr_un socket_address(const string &path)
+{
+    struct sockaddr_un addr = { };
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw invalid_argument("Socket path too long " + path);
+    strcpy(addr.sun_path, path.c_str());
+    return addr;
+}
+
+static bool run_server(const resample_args &args)
+{
+    WarmCache warm;
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    try {
+        auto addr = socket_address(args.serve);
+        unlink(args.serve.c_str());
+        if (sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(sock, 16) < 0)
+            throw runtime_error("Failed to listen on " + args.serve + ": " + strerror(errno));
+    } catch (exception &e) {
+        cout << e.what() << endl;
+        if (sock >= 0) close(sock);
+        return false;
+    }
+
+    /* Writes to closed pipes fail the job instead of the server */
+    signal(SIGPIPE, SIG_IGN);
+    cout << "Serving on " << args.serve << endl;
+
+    for (;;) {
+        int fd = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            cout << "Failed to accept connection: " << strerror(errno) << endl;
+            break;
+        }
+        thread(serve_job, cref(args), ref(warm), fd).detach();
+    }
+    close(sock);
+    return false;
+}
+
+/*
+ * Client mode. The input and output are opened locally and passed to the
+ * server as descriptors.
+ */
+static bool run_client(const resample_args &args, size_t &n_wr)
+{
+    int sock = -1, fds[2] = { -1, -1 };
+    bool ok = false;
+
+    try {
+        auto addr = socket_address(args.client);
+        fds[0] = args.infile == "-" ? dup(STDIN_FILENO) : open(args.infile.c_str(), O_RDONLY);
+        if (fds[0] < 0) throw runtime_error("Failed to open input file " + args.infile);
+        fds[1] = args.outfile == "-" ? dup(STDOUT_FILENO) :
+                 open(args.outfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fds[1] < 0) throw runtime_error("Failed to open output file " + args.outfile);
+
+        sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (sock < 0 || connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+            throw runtime_error("Failed to connect to " + args.client + ": " + strerror(errno));
+
+        string line = args.type + " " + to_string(args.p) + " " + to_string(args.q) + " - -\n";
+        char ctrl[CMSG_SPACE(sizeof(fds))] = { };
+        struct iovec iov = { (void *) line.data(), line.size() };
+        struct msghdr msg = { };
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+        auto c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(c), fds, sizeof(fds));
+        if (sendmsg(sock, &msg, MSG_NOSIGNAL) != (ssize_t) line.size())
+            throw runtime_error(string("Failed to send request: ") + strerror(errno));
+
+        string reply;
+        char buf[256];
+        ssize_t n;
+        while (reply.find('\n') == string::npos && (n = recv(sock, buf, sizeof(buf), 0)) > 0)
+            reply.append(buf, n);
+        reply = reply.substr(0, reply.find('\n'));
+        if (reply.compare(0, 3, "OK "))
+            throw runtime_error(reply.empty() ? "No reply from server" : reply.substr(reply.find(' ') + 1));
+        n_wr = stoul(reply.substr(3));
+        ok = true;
+    } catch (exception &e) {
+        cout << e.what() << endl;
+    }
+
+    for (auto fd : fds)
+        if (fd >= 0) close(fd);
+    if (sock >= 0) close(sock);
+    return ok;
+}
 
 int main(int argc, char **argv)
 {
     resample_args args;
     if (!handle_options(argc, argv, args)) return -1;
 
-    ifstream istr(args.infile, std::ifstream::binary);
-    if (istr.fail()) {
-        cout << "Failed to open input file " << args.infile << endl;
-        return -1;
+    /* Keep status messages out of the sample stream */
+    if (args.outfile == "-") cout.rdbuf(cerr.rdbuf());
+
+    if (!args.serve.empty())
+        return run_server(args) ? 0 : -1;
+
+    if (args.autotune) {
+        args.block_size = autotune(args);
+        cout << "Autotuned block size " << args.block_size << " bytes" << endl;
     }
 
-    ofstream ostr;
-    ostr.open(args.outfile, ios::out | ios::binary);
-    if (ostr.fail()) {
-        cout << "Failed to open output file " << args.outfile << endl;
-        istr.close();
+    if (!args.manifest.empty() || !args.pattern.empty())
+        return run_batch(args) ? 0 : -1;
+    if (!args.client.empty()) {
+        size_t n_wr = 0;
+        if (!run_client(args, n_wr)) return -1;
+        print_done(n_wr, n_wr*sample_type_map[args.type].second, args.outfile, args.type);
+        return 0;
+    }
+
+    Stats stats;
+    stats.start = stats.last = now();
+
+    if (args.mmap || args.threads > 1) {
+        if (!(args.mmap ? run_mapped(args, stats) : run_threaded(args, stats))) return -1;
+        print_done(stats.n_out, stats.n_out*sample_type_map[args.type].second, args.outfile, args.type);
+        if (args.stats) print_stats(args, stats);
+        return 0;
+    }
+
+    unique_ptr<Source> source;
+    unique_ptr<Sink> sink;
+    try {
+        open_stream(args, source, sink);
+    } catch (exception &e) {
+        cout << e.what() << endl;
         return -1;
     }
 
-    int type_sz = sample_type_map[args.type].second;
-    int blk_sz = type_sz * args.q;
-    int n_blks = blk_sz > BLOCKSIZE ? 1 : BLOCKSIZE / blk_sz;
-    size_t n_wr = 0;
-
-    auto run_resampler = [&](auto resampler, auto input, auto output) {
-        while (!istr.eof()) {
-            istr.read((char *) input.data(), input.size()*type_sz);
-            auto n_rd = istr.gcount();
-            if (n_rd != n_blks * blk_sz) {
-                if (n_rd < blk_sz) break;
-                n_blks = n_rd / blk_sz;
-                input.resize(n_blks * args.q);
-                output.resize(n_blks * args.p);
-            }
-            resampler.resample(input, output);
-            ostr.write((char *) output.data(), output.size() * type_sz);
-            n_wr += output.size();
-        }
-    };
+    try {
+        run_stream(args, *source, *sink, stats);
+    } catch (exception &e) {
+        cout << e.what() << endl;
+        return -1;
+    }
 
-    if      (args.type == "fc64") RUN_COMPLEX_RESAMPLER(double)
-    else if (args.type == "fc32") RUN_COMPLEX_RESAMPLER(float)
-    else if (args.type == "sc64") RUN_COMPLEX_RESAMPLER(long)
-    else if (args.type == "sc32") RUN_COMPLEX_RESAMPLER(int)
-    else if (args.type == "sc16") RUN_COMPLEX_RESAMPLER(short)
-    else if (args.type ==  "sc8") RUN_COMPLEX_RESAMPLER(char)
-    else if (args.type ==  "f64") RUN_REAL_RESAMPLER(double)
-    else if (args.type ==  "f32") RUN_REAL_RESAMPLER(float)
-    else if (args.type ==  "s64") RUN_REAL_RESAMPLER(long)
-    else if (args.type ==  "s32") RUN_REAL_RESAMPLER(int)
-    else if (args.type ==  "s16") RUN_REAL_RESAMPLER(short)
-    else if (args.type ==   "s8") RUN_REAL_RESAMPLER(char)
-
-    print_done(n_wr, n_wr*type_sz, args.outfile, args.type);
-
-    istr.close();
-    ostr.close();
+    print_done(stats.n_out, stats.n_out*sample_type_map[args.type].second, args.outfile, args.type);
+    if (args.stats) print_stats(args, stats);
 }
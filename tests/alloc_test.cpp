@@ -0,0 +1,267 @@
+/*
+ * Steady State Allocation Test
+ *
+ * Copyright (C) 2019 Tom Tsou <tom@tsou.cc>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <complex>
+#include <vector>
+#include <string>
+#include <random>
+#include <atomic>
+#include <functional>
+#include <new>
+#include <cstdlib>
+#include <cstdint>
+
+#include "Resampler.h"
+
+using namespace std;
+
+static const unsigned P = 3, Q = 2;
+static const unsigned ntaps = 64;
+static const unsigned channels = 3;
+static const unsigned calls = 200;
+
+/*
+ * Largest input length in samples per channel. Its output length spans more
+ * than two parallel chunks, so threaded calls split the work.
+ */
+static const size_t max_len = 24000;
+
+static atomic<uint64_t> allocations(0);
+
+/*
+ * Allocation hooks. On glibc the C allocator is interposed through its
+ * internal entry points, which also covers operator new. Elsewhere only
+ * operator new is counted.
+ */
+#ifdef __GLIBC__
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+extern "C" void *malloc(size_t size)
+{
+    allocations++;
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size)
+{
+    allocations++;
+    return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+static void *allocate(size_t size)
+{
+#ifndef __GLIBC__
+    allocations++;
+#endif
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) throw bad_alloc();
+    return ptr;
+}
+
+void *operator new(size_t size) { return allocate(size); }
+void *operator new[](size_t size) { return allocate(size); }
+void *operator new(size_t size, const nothrow_t &) noexcept { return malloc(size ? size : 1); }
+void *operator new[](size_t size, const nothrow_t &) noexcept { return malloc(size ? size : 1); }
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
+
+struct test_case {
+    string name;
+    function<uint64_t(mt19937 &)> run;
+    uint64_t allocations;
+};
+
+/*
+ * Allocations over 'calls' calls of random legal lengths, from the filter
+ * history up to 'max_len' in multiples of Q, after one warm-up call at the
+ * largest length. Buffers are reserved beforehand, so only the resampler can
+ * allocate.
+ */
+template <typename F>
+static uint64_t count_allocations(F call, mt19937 &rng)
+{
+    uniform_int_distribution<size_t> dist((ntaps - 1 + Q - 1) / Q, max_len / Q);
+    call(max_len);
+
+    uint64_t before = allocations;
+    for (unsigned i = 0; i < calls; i++)
+        call(dist(rng) * Q);
+    return allocations - before;
+}
+
+template <typename R, typename S>
+static uint64_t vector_calls(R &resampler, mt19937 &rng, unsigned n = 1)
+{
+    vector<S> in, out;
+    in.reserve(max_len * n);
+    out.reserve(max_len / Q * P * n);
+    return count_allocations([&](size_t len) {
+        in.resize(len * n);
+        out.resize(len / Q * P * n);
+        resampler.resample(in, out);
+    }, rng);
+}
+
+template <typename R, typename S>
+static uint64_t pointer_calls(R &resampler, mt19937 &rng)
+{
+    vector<S> in(max_len), out(max_len / Q * P);
+    return count_allocations([&](size_t len) {
+        resampler.resample(in.data(), len, out.data(), len / Q * P);
+    }, rng);
+}
+
+template <typename T>
+static uint64_t planar_calls(ComplexResampler<T> &resampler, mt19937 &rng)
+{
+    vector<T> in_i, in_q, out_i, out_q;
+    in_i.reserve(max_len);
+    in_q.reserve(max_len);
+    out_i.reserve(max_len / Q * P);
+    out_q.reserve(max_len / Q * P);
+    return count_allocations([&](size_t len) {
+        in_i.resize(len);
+        in_q.resize(len);
+        out_i.resize(len / Q * P);
+        out_q.resize(len / Q * P);
+        resampler.resample(in_i, in_q, out_i, out_q);
+    }, rng);
+}
+
+template <typename T>
+static uint64_t planar_out_calls(ComplexResampler<T> &resampler, mt19937 &rng)
+{
+    vector<complex<T>> in;
+    vector<T> out_i, out_q;
+    in.reserve(max_len);
+    out_i.reserve(max_len / Q * P);
+    out_q.reserve(max_len / Q * P);
+    return count_allocations([&](size_t len) {
+        in.resize(len);
+        out_i.resize(len / Q * P);
+        out_q.resize(len / Q * P);
+        resampler.resample(in, out_i, out_q);
+    }, rng);
+}
+
+template <typename T>
+static uint64_t channel_calls(MultiResampler<T> &resampler, mt19937 &rng)
+{
+    vector<vector<complex<T>>> in(resampler.channels()), out(resampler.channels());
+    for (unsigned c = 0; c < resampler.channels(); c++) {
+        in[c].reserve(max_len);
+        out[c].reserve(max_len / Q * P);
+    }
+    return count_allocations([&](size_t len) {
+        for (unsigned c = 0; c < resampler.channels(); c++) {
+            in[c].resize(len);
+            out[c].resize(len / Q * P);
+        }
+        resampler.resample(in, out);
+    }, rng);
+}
+
+template <typename R, typename S>
+static test_case vector_case(const string &name, unsigned threads = 1)
+{
+    return { name, [=](mt19937 &rng) {
+        R resampler(P, Q, ntaps);
+        resampler.set_threads(threads);
+        return vector_calls<R, S>(resampler, rng);
+    }, 0 };
+}
+
+static void print_test_result(const test_case &test)
+{
+    cout << "Allocation Case " << test.name << endl;
+    cout << "==============" << endl;
+    cout << "  Calls:             " << calls << endl;
+    cout << "  Allocations:       " << test.allocations << endl;
+    cout << "  Result:            " << (test.allocations ? "Fail" : "Pass") << endl;
+    cout << endl;
+}
+
+int main(int argc, char **argv)
+{
+    vector<test_case> tests {
+        vector_case<ComplexResampler<double>, complex<double>>("fc64"),
+        vector_case<ComplexResampler<float>, complex<float>>("fc32"),
+        vector_case<ComplexResampler<float, Precision::Float>, complex<float>>("fc32 float"),
+        vector_case<ComplexResampler<short>, complex<short>>("sc16"),
+        vector_case<ComplexResampler<char>, complex<char>>("sc8"),
+        vector_case<ComplexResampler<float>, complex<float>>("fc32 threaded", 2),
+        vector_case<RealResampler<double>, double>("f64"),
+        vector_case<RealResampler<float>, float>("f32"),
+        vector_case<RealResampler<float, Precision::Float>, float>("f32 float"),
+        vector_case<RealResampler<short>, short>("s16"),
+        vector_case<RealResampler<short>, short>("s16 threaded", 2),
+        { "fc32 pointer", [](mt19937 &rng) {
+            ComplexResampler<float> resampler(P, Q, ntaps);
+            return pointer_calls<ComplexResampler<float>, complex<float>>(resampler, rng);
+        }, 0 },
+        { "s16 pointer", [](mt19937 &rng) {
+            RealResampler<short> resampler(P, Q, ntaps);
+            return pointer_calls<RealResampler<short>, short>(resampler, rng);
+        }, 0 },
+        { "sc16 planar", [](mt19937 &rng) {
+            ComplexResampler<short> resampler(P, Q, ntaps);
+            return planar_calls(resampler, rng);
+        }, 0 },
+        { "sc16 planar output", [](mt19937 &rng) {
+            ComplexResampler<short> resampler(P, Q, ntaps);
+            return planar_out_calls(resampler, rng);
+        }, 0 },
+        { "fc32 multichannel", [](mt19937 &rng) {
+            MultiResampler<float> resampler(P, Q, channels, ntaps);
+            return vector_calls<MultiResampler<float>, complex<float>>(resampler, rng, channels);
+        }, 0 },
+        { "fc32 multichannel threaded", [](mt19937 &rng) {
+            MultiResampler<float> resampler(P, Q, channels, ntaps);
+            resampler.set_threads(2);
+            return vector_calls<MultiResampler<float>, complex<float>>(resampler, rng, channels);
+        }, 0 },
+        { "sc16 per channel", [](mt19937 &rng) {
+            MultiResampler<short> resampler(P, Q, channels, ntaps);
+            return channel_calls(resampler, rng);
+        }, 0 },
+    };
+
+    int pass = 0;
+    mt19937 rng(1);
+    for (auto &test:tests) {
+        test.allocations = test.run(rng);
+        print_test_result(test);
+        pass += !test.allocations;
+    }
+    cout << "Completed " << tests.size() << " tests: " << pass << " passed and "
+         << tests.size() - pass << " failed" << endl;
+    return pass == (int) tests.size() ? 0 : 1;
+}
@@ -0,0 +1,568 @@
+/*
+ * Differential Kernel Test
+ *
+ * Copyright (C) 2019 Tom Tsou <tom@tsou.cc>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <complex>
+#include <vector>
+#include <string>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <thread>
+#include <cmath>
+#include <cstdlib>
+
+#include "Resampler.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+static const unsigned default_seed = 1;
+static const unsigned default_trials = 16;
+static const unsigned max_pq = 16;
+static const unsigned max_taps = 160;
+static const unsigned max_channels = 4;
+static const unsigned threads = 3;
+
+/*
+ * Outputs per trial. The minimum exceeds two parallel chunks so that the
+ * threaded kernels split the work.
+ */
+static const size_t min_outputs = 9000;
+static const size_t max_outputs = 16000;
+
+static vector<pair<unsigned, unsigned>> large_ratios { { 147, 160 }, { 160, 147 }, { 441, 480 } };
+
+/*
+ * Random configuration. The input is split into blocks of random length that
+ * are multiples of Q and no shorter than the filter history. Full scale
+ * trials fill the input with runs of the most positive and negative values,
+ * so that the filter overshoot drives integral outputs into saturation.
+ */
+struct trial {
+    unsigned seed, p, q, taps, channels;
+    size_t len;
+    vector<size_t> blocks;
+    bool full_scale;
+};
+
+/*
+ * Largest absolute difference over all trials between a kernel output and
+ * either the golden reference or, where bit-exactness is promised, the output
+ * of another kernel, in which case the bound is zero
+ */
+struct divergence {
+    string kernel;
+    string reference;
+    double worst;
+    double bound;
+    string worst_case;
+    bool pass;
+};
+
+template <typename T>
+static double full_scale()
+{
+    return is_integral<T>::value ? numeric_limits<T>::max() : 1.0;
+}
+
+/*
+ * Allowed divergence from the golden reference in output units. The
+ * reference repeats the double precision arithmetic of the library, so
+ * integral outputs, after rounding and saturation, must match exactly. Only
+ * floating point outputs may differ in their last bits, or more with float
+ * accumulation.
+ */
+template <typename T, Precision R>
+static double error_bound()
+{
+    if (R == Precision::Float) return 1e-5;
+    if (is_floating_point<T>::value) return 4 * numeric_limits<T>::epsilon();
+    return 0.0;
+}
+
+static trial make_trial(mt19937 &rng, unsigned seed)
+{
+    auto uniform = [&](size_t lo, size_t hi) {
+        return uniform_int_distribution<size_t>(lo, hi)(rng);
+    };
+
+    trial t;
+    t.seed = seed;
+    if (uniform(0, 3)) {
+        t.p = uniform(1, max_pq);
+        t.q = uniform(1, max_pq);
+    } else {
+        auto r = large_ratios[uniform(0, large_ratios.size() - 1)];
+        t.p = r.first;
+        t.q = r.second;
+    }
+    t.taps = uniform(1, max_taps);
+    t.channels = uniform(1, max_channels);
+    t.len = (uniform(min_outputs, max_outputs) + t.p - 1) / t.p * t.q;
+    t.full_scale = !uniform(0, 3);
+
+    size_t min_blk = max<size_t>((t.taps - 1 + t.q - 1) / t.q, 1);
+    for (size_t pos = 0; pos < t.len;) {
+        size_t blk = uniform(min_blk, 4 * min_blk + 64) * t.q;
+        if (t.len - pos < blk + min_blk * t.q) blk = t.len - pos;
+        t.blocks.push_back(blk);
+        pos += blk;
+    }
+    return t;
+}
+
+template <typename T>
+static void randomize(vector<T> &x, mt19937 &rng, bool full)
+{
+    if (full) {
+        T hi = is_integral<T>::value ? numeric_limits<T>::max() : 1;
+        T lo = is_integral<T>::value ? numeric_limits<T>::min() : -1;
+        uniform_int_distribution<size_t> run(1, 8);
+        for (size_t k = 0, n = 0; k < x.size(); k++, n--) {
+            if (!n) {
+                n = run(rng);
+                swap(hi, lo);
+            }
+            x[k] = hi;
+        }
+        return;
+    }
+
+    uniform_real_distribution<double> dist(-0.5, 0.5);
+    for (auto &v:x) {
+        double a = dist(rng) * full_scale<T>();
+        v = is_integral<T>::value ? rint(a) : a;
+    }
+}
+
+template <typename T>
+static void randomize(vector<complex<T>> &x, mt19937 &rng, bool full)
+{
+    vector<T> i(x.size()), q(x.size());
+    randomize(i, rng, full);
+    randomize(q, rng, full);
+    for (size_t k = 0; k < x.size(); k++)
+        x[k] = complex<T>(i[k], q[k]);
+}
+
+/*
+ * Golden conversion, rounding to nearest and saturating integral outputs
+ */
+template <typename T>
+static T quantize(double a, false_type)
+{
+    return a;
+}
+
+template <typename T>
+static T quantize(double a, true_type)
+{
+    double lo = numeric_limits<T>::min(), hi = numeric_limits<T>::max();
+    if (hi >= ldexp(1.0, numeric_limits<T>::digits))
+        hi = nextafter(hi, 0.0);
+    return rint(min(max(a, lo), hi));
+}
+
+/*
+ * Golden reference, the scalar loop without blocking, history handling or
+ * threads. Output 'n' of the stream applies partition (n * Q) % P to the taps
+ * starting at input (n * Q) / P, with taps-1 zeros ahead of the first input,
+ * accumulating in double in tap order.
+ */
+template <typename T>
+static vector<T> reference(const trial &t, const vector<T> &x)
+{
+    auto fb = Resampler::design(t.p, t.q, t.taps, false);
+    const auto &bank = fb->partitions;
+    vector<double> pad(t.taps - 1 + x.size());
+    copy(x.begin(), x.end(), pad.begin() + t.taps - 1);
+
+    vector<T> y(x.size() / t.q * t.p);
+    for (size_t n = 0; n < y.size(); n++) {
+        const auto &h = bank[n * t.q % t.p];
+        size_t first = n * t.q / t.p;
+        double a = 0.0;
+        for (size_t j = 0; j < t.taps; j++)
+            a += h[j] * pad[first + j];
+        y[n] = quantize<T>(a, is_integral<T>());
+    }
+    return y;
+}
+
+template <typename T>
+static vector<complex<T>> reference(const trial &t, const vector<complex<T>> &x)
+{
+    vector<T> xi(x.size()), xq(x.size());
+    for (size_t k = 0; k < x.size(); k++) {
+        xi[k] = x[k].real();
+        xq[k] = x[k].imag();
+    }
+    auto yi = reference(t, xi), yq = reference(t, xq);
+    vector<complex<T>> y(yi.size());
+    for (size_t k = 0; k < y.size(); k++)
+        y[k] = complex<T>(yi[k], yq[k]);
+    return y;
+}
+
+template <typename T>
+static vector<double> samples(const vector<T> &y)
+{
+    return vector<double>(y.begin(), y.end());
+}
+
+template <typename T>
+static vector<double> samples(const vector<complex<T>> &y)
+{
+    vector<double> s;
+    for (auto &v:y) {
+        s.push_back(v.real());
+        s.push_back(v.imag());
+    }
+    return s;
+}
+
+static divergence compare(const trial &t, const string &kernel, const string &reference,
+                          const vector<double> &y, const vector<double> &r, double bound)
+{
+    double worst = y.size() == r.size() ? 0.0 : numeric_limits<double>::infinity();
+    for (size_t i = 0; i < min(y.size(), r.size()); i++) {
+        double d = fabs(y[i] - r[i]);
+        if (!(d <= worst)) worst = d;
+    }
+
+    ostringstream ss;
+    ss << t.p << "/" << t.q << ", " << t.taps << " taps, "
+       << t.channels << " channels, seed " << t.seed;
+    return { kernel, reference, worst, bound, ss.str(), worst <= bound };
+}
+
+/*
+ * Resample 'x' of 'n' interleaved channels in the trial's block split
+ */
+template <typename R, typename S>
+static vector<S> run_split(R &resampler, const trial &t, const vector<S> &x, unsigned n = 1)
+{
+    vector<S> y;
+    auto pos = x.begin();
+    for (auto blk:t.blocks) {
+        vector<S> in(pos, pos + blk * n), out(blk / t.q * t.p * n);
+        resampler.resample(in, out);
+        y.insert(y.end(), out.begin(), out.end());
+        pos += blk * n;
+    }
+    return y;
+}
+
+template <typename T, Precision R>
+static void complex_kernels(const string &name, const trial &t, mt19937 &rng,
+                            vector<divergence> &results)
+{
+    typedef ComplexResampler<T, R> resampler;
+    double bound = error_bound<T, R>();
+    vector<complex<T>> x(t.len), y(t.len / t.q * t.p);
+    randomize(x, rng, t.full_scale);
+    auto golden = samples(reference(t, x));
+
+    resampler vec(t.p, t.q, t.taps);
+    vec.resample(x, y);
+    auto base = samples(y);
+    results.push_back(compare(t, name + " vector", "golden", base, golden, bound));
+
+    resampler ptr(t.p, t.q, t.taps);
+    vector<complex<T>> y_ptr(y.size());
+    ptr.resample(x.data(), x.size(), y_ptr.data(), y_ptr.size());
+    results.push_back(compare(t, name + " pointer", name + " vector", samples(y_ptr), base, 0.0));
+
+    resampler blocks(t.p, t.q, t.taps);
+    auto y_split = run_split(blocks, t, x);
+    results.push_back(compare(t, name + " split", name + " vector", samples(y_split), base, 0.0));
+
+    resampler threaded(t.p, t.q, t.taps);
+    vector<complex<T>> y_thr(y.size());
+    threaded.set_threads(threads);
+    threaded.resample(x, y_thr);
+    results.push_back(compare(t, name + " threaded", name + " vector", samples(y_thr), base, 0.0));
+
+    vector<T> xi(x.size()), xq(x.size()), yi(y.size()), yq(y.size());
+    for (size_t k = 0; k < x.size(); k++) {
+        xi[k] = x[k].real();
+        xq[k] = x[k].imag();
+    }
+    resampler planar(t.p, t.q, t.taps);
+    planar.resample(xi, xq, yi, yq);
+    vector<complex<T>> y_planar(y.size());
+    for (size_t k = 0; k < y.size(); k++)
+        y_planar[k] = complex<T>(yi[k], yq[k]);
+    results.push_back(compare(t, name + " planar", "golden", samples(y_planar), golden, bound));
+
+    resampler planar_out(t.p, t.q, t.taps);
+    planar_out.resample(x, yi, yq);
+    for (size_t k = 0; k < y.size(); k++)
+        y_planar[k] = complex<T>(yi[k], yq[k]);
+    results.push_back(compare(t, name + " planar-out", "golden", samples(y_planar), golden, bound));
+}
+
+template <typename T, Precision R>
+static void multi_kernels(const string &name, const trial &t, mt19937 &rng,
+                          vector<divergence> &results)
+{
+    typedef MultiResampler<T, R> resampler;
+    double bound = error_bound<T, R>();
+    unsigned N = t.channels;
+    size_t n_out = t.len / t.q * t.p;
+
+    vector<vector<complex<T>>> xc(N, vector<complex<T>>(t.len)), yc(N, vector<complex<T>>(n_out));
+    vector<complex<T>> x(t.len * N), y(n_out * N), r(n_out * N);
+    for (unsigned c = 0; c < N; c++) {
+        randomize(xc[c], rng, t.full_scale);
+        auto rc = reference(t, xc[c]);
+        for (size_t k = 0; k < t.len; k++)
+            x[k * N + c] = xc[c][k];
+        for (size_t k = 0; k < n_out; k++)
+            r[k * N + c] = rc[k];
+    }
+    auto golden = samples(r);
+
+    resampler multi(t.p, t.q, N, t.taps);
+    multi.resample(x, y);
+    auto base = samples(y);
+    results.push_back(compare(t, name + " multi", "golden", base, golden, bound));
+
+    resampler blocks(t.p, t.q, N, t.taps);
+    auto y_split = run_split(blocks, t, x, N);
+    results.push_back(compare(t, name + " multi-split", name + " multi", samples(y_split), base, 0.0));
+
+    resampler threaded(t.p, t.q, N, t.taps);
+    vector<complex<T>> y_thr(y.size());
+    threaded.set_threads(threads);
+    threaded.resample(x, y_thr);
+    results.push_back(compare(t, name + " multi-threaded", name + " multi", samples(y_thr), base, 0.0));
+
+    resampler channels(t.p, t.q, N, t.taps);
+    channels.resample(xc, yc);
+    for (unsigned c = 0; c < N; c++)
+        for (size_t k = 0; k < n_out; k++)
+            y[k * N + c] = yc[c][k];
+    results.push_back(compare(t, name + " multi-channels", "golden", samples(y), golden, bound));
+}
+
+template <typename T, Precision R>
+static void real_kernels(const string &name, const trial &t, mt19937 &rng,
+                         vector<divergence> &results)
+{
+    typedef RealResampler<T, R> resampler;
+    double bound = error_bound<T, R>();
+    vector<T> x(t.len), y(t.len / t.q * t.p);
+    randomize(x, rng, t.full_scale);
+    auto golden = samples(reference(t, x));
+
+    resampler vec(t.p, t.q, t.taps);
+    vec.resample(x, y);
+    auto base = samples(y);
+    results.push_back(compare(t, name + " vector", "golden", base, golden, bound));
+
+    resampler ptr(t.p, t.q, t.taps);
+    vector<T> y_ptr(y.size());
+    ptr.resample(x.data(), x.size(), y_ptr.data(), y_ptr.size());
+    results.push_back(compare(t, name + " pointer", name + " vector", samples(y_ptr), base, 0.0));
+
+    resampler blocks(t.p, t.q, t.taps);
+    auto y_split = run_split(blocks, t, x);
+    results.push_back(compare(t, name + " split", name + " vector", samples(y_split), base, 0.0));
+
+    resampler threaded(t.p, t.q, t.taps);
+    vector<T> y_thr(y.size());
+    threaded.set_threads(threads);
+    threaded.resample(x, y_thr);
+    results.push_back(compare(t, name + " threaded", name + " vector", samples(y_thr), base, 0.0));
+}
+
+/*
+ * Every kernel of every sample type and precision on one random trial. The
+ * sequence of results is the same for all trials.
+ */
+static void run_trial(unsigned seed, vector<divergence> &results)
+{
+    mt19937 rng(seed);
+    trial t = make_trial(rng, seed);
+
+    complex_kernels<double, Precision::Double>("fc64", t, rng, results);
+    complex_kernels<float, Precision::Double>("fc32", t, rng, results);
+    complex_kernels<float, Precision::Float>("fc32-float", t, rng, results);
+    complex_kernels<long, Precision::Double>("sc64", t, rng, results);
+    complex_kernels<int, Precision::Double>("sc32", t, rng, results);
+    complex_kernels<short, Precision::Double>("sc16", t, rng, results);
+    complex_kernels<char, Precision::Double>("sc8", t, rng, results);
+
+    multi_kernels<double, Precision::Double>("fc64", t, rng, results);
+    multi_kernels<float, Precision::Double>("fc32", t, rng, results);
+    multi_kernels<float, Precision::Float>("fc32-float", t, rng, results);
+    multi_kernels<long, Precision::Double>("sc64", t, rng, results);
+    multi_kernels<int, Precision::Double>("sc32", t, rng, results);
+    multi_kernels<short, Precision::Double>("sc16", t, rng, results);
+    multi_kernels<char, Precision::Double>("sc8", t, rng, results);
+
+    real_kernels<double, Precision::Double>("f64", t, rng, results);
+    real_kernels<float, Precision::Double>("f32", t, rng, results);
+    real_kernels<float, Precision::Float>("f32-float", t, rng, results);
+    real_kernels<long, Precision::Double>("s64", t, rng, results);
+    real_kernels<int, Precision::Double>("s32", t, rng, results);
+    real_kernels<short, Precision::Double>("s16", t, rng, results);
+    real_kernels<char, Precision::Double>("s8", t, rng, results);
+}
+
+/*
+ * One fixed block long enough that Q times the output index passes 2^32, as
+ * in the multi-megabyte calls of mapped files, with a short filter to keep
+ * the reference cheap
+ */
+static void run_large_offsets(vector<divergence> &results)
+{
+    trial t;
+    t.seed = 0;
+    t.p = 2000;
+    t.q = 1999;
+    t.taps = 8;
+    t.channels = 1;
+    t.full_scale = false;
+    t.len = ((1ULL << 32) / t.q / t.p + 16) * t.q;
+    t.blocks = { t.len / t.q / 2 * t.q, t.len - t.len / t.q / 2 * t.q };
+
+    mt19937 rng(t.seed);
+    vector<divergence> r;
+    real_kernels<float, Precision::Double>("f32", t, rng, r);
+    complex_kernels<short, Precision::Double>("sc16", t, rng, r);
+    for (auto &d:r) {
+        d.kernel += " large-offset";
+        results.push_back(d);
+    }
+}
+
+/*
+ * True if the reference clips at both ends of the output range
+ */
+template <typename T>
+static bool clipped(const vector<double> &y)
+{
+    double hi = quantize<T>(numeric_limits<double>::max(), true_type());
+    double lo = quantize<T>(-numeric_limits<double>::max(), true_type());
+    return count(y.begin(), y.end(), hi) && count(y.begin(), y.end(), lo);
+}
+
+template <typename T>
+static void saturation_kernels(const string &real_name, const string &complex_name,
+                               const trial &t, mt19937 &rng, vector<divergence> &results)
+{
+    vector<T> x(t.len), y(t.len / t.q * t.p);
+    randomize(x, rng, true);
+    auto golden = samples(reference(t, x));
+    RealResampler<T> real(t.p, t.q, t.taps);
+    real.resample(x, y);
+    auto d = compare(t, real_name + " saturation", "golden", samples(y), golden, 0.0);
+    d.pass &= clipped<T>(golden);
+    results.push_back(d);
+
+    vector<complex<T>> xc(t.len), yc(y.size());
+    randomize(xc, rng, true);
+    golden = samples(reference(t, xc));
+    ComplexResampler<T> cplx(t.p, t.q, t.taps);
+    cplx.resample(xc, yc);
+    d = compare(t, complex_name + " saturation", "golden", samples(yc), golden, 0.0);
+    d.pass &= clipped<T>(golden);
+    results.push_back(d);
+}
+
+/*
+ * Full scale input to each integral type at a fixed rate, long enough to pass
+ * through both the SSE2 batches and the scalar tail of the output conversion.
+ * Outputs must equal the rounded and saturated reference, which must itself
+ * clip at both ends of the range, so that the clamp is known to be exercised.
+ */
+static void run_saturation(vector<divergence> &results)
+{
+    trial t;
+    t.seed = 0;
+    t.p = 3;
+    t.q = 2;
+    t.taps = 48;
+    t.channels = 1;
+    t.full_scale = true;
+    t.len = 6002;
+    t.blocks = { t.len };
+
+    mt19937 rng(t.seed);
+    saturation_kernels<long>("s64", "sc64", t, rng, results);
+    saturation_kernels<int>("s32", "sc32", t, rng, results);
+    saturation_kernels<short>("s16", "sc16", t, rng, results);
+    saturation_kernels<char>("s8", "sc8", t, rng, results);
+}
+
+static void print_result(const divergence &d)
+{
+    cout << "Kernel " << d.kernel << endl;
+    cout << "==============" << endl;
+    cout << "  Reference:         " << d.reference << endl;
+    cout << "  Worst divergence:  " << d.worst << endl;
+    cout << "  Bound:             " << d.bound << endl;
+    cout << "  Worst case:        " << d.worst_case << endl;
+    cout << "  Result:            " << (d.pass ? "Pass" : "Fail") << endl;
+    cout << endl;
+}
+
+/*
+ * Usage: kernel_test [seed [trials]]
+ */
+int main(int argc, char **argv)
+{
+    unsigned seed = argc > 1 ? atoi(argv[1]) : default_seed;
+    unsigned trials = argc > 2 ? atoi(argv[2]) : default_trials;
+    if (!trials) return -1;
+
+    vector<vector<divergence>> results(trials);
+    ThreadPool pool(max(thread::hardware_concurrency(), 1u));
+    pool.parallel(trials, [&](size_t i, unsigned) {
+        run_trial(seed + i, results[i]);
+    });
+
+    /* Worst case of each kernel across trials */
+    auto worst = results[0];
+    for (auto &r:results) {
+        for (size_t k = 0; k < r.size(); k++) {
+            if (!(r[k].worst <= worst[k].worst)) {
+                worst[k].worst = r[k].worst;
+                worst[k].worst_case = r[k].worst_case;
+            }
+            worst[k].pass &= r[k].pass;
+        }
+    }
+    run_large_offsets(worst);
+    run_saturation(worst);
+
+    cout << "Seed " << seed << ", " << trials << " trials" << endl << endl;
+    int pass = 0;
+    for (auto &w:worst) {
+        print_result(w);
+        pass += w.pass;
+    }
+    cout << "Completed " << worst.size() << " kernels: " << pass << " passed and "
+         << worst.size() - pass << " failed" << endl;
+    return pass == (int) worst.size() ? 0 : 1;
+}
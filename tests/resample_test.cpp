@@ -5,9 +5,12 @@
 #include <complex>
 #include <vector>
 #include <climits>
+#include <limits>
 #include <algorithm>
+#include <thread>
 
 #include "Resampler.h"
+#include "ThreadPool.h"
 
 using namespace std;
 
@@ -21,6 +24,8 @@ struct test_case {
     int num;
     double freq;
     string type;
+    string precision;
+    string layout;
     int p, q;
     double rmse;
     bool pass;
@@ -28,6 +33,8 @@ struct test_case {
 
 static vector<double> freqs { 2e3, 5e3, 7e3 };
 static vector<string> types { "fc64", "fc32", "sc64", "sc32", "sc16", "sc8", "f64", "f32", "s64", "s32", "s16", "s8" };
+static vector<string> float_types { "fc32", "f32" };
+static vector<string> planar_types { "fc64", "fc32", "sc64", "sc32", "sc16", "sc8" };
 static vector<int> pq { 1, 2, 3, 4, 5, 6, 7 };
 
 static void print_test_result(test_case &test)
@@ -36,13 +43,15 @@ static void print_test_result(test_case &test)
     cout << "==============" << endl;
     cout << "  Tone Frequency:    " << test.freq << endl;
     cout << "  Sample type:       " << test.type << endl;
+    cout << "  Precision:         " << test.precision << endl;
+    cout << "  Layout:            " << test.layout << endl;
     cout << "  Ratio:             " << test.p << "/" << test.q << endl;
     cout << "  Error (RMSE):      " << test.rmse << endl;
     cout << "  Result:            " << (test.pass ? "Pass" : "Fail") << endl;
     cout << endl;
 }
 
-#define COMPLEX_TEST(T, SCALE) \
+#define COMPLEX_TEST(T, R, SCALE) \
 { \
     vector<complex<T>> input(test_sz/test.q * test.q); \
     vector<complex<T>> output(input.size() * test.p / test.q); \
@@ -54,14 +63,35 @@ static void print_test_result(test_case &test)
     for (unsigned i = 0; i < target.size(); i++) \
         target[i] = complex<double>(sin(2.0*M_PI*i*test.freq/nrate) * (double) SCALE * ampl, \
                                     cos(2.0*M_PI*i*test.freq/nrate) * (double) SCALE * ampl); \
-    ComplexResampler<T> resampler(test.p, test.q, ntaps); \
+    ComplexResampler<T, R> resampler(test.p, test.q, ntaps); \
     resampler.resample(input, output); \
     test.rmse = complex_rmse(target, output, ntaps*test.p/test.q/2)/SCALE; \
     test.pass = test.rmse < pass_limit; \
-    print_test_result(test); \
 }
 
-#define REAL_TEST(T, SCALE) \
+#define PLANAR_TEST(T, SCALE) \
+{ \
+    vector<T> input_i(test_sz/test.q * test.q), input_q(input_i.size()); \
+    vector<T> output_i(input_i.size() * test.p / test.q), output_q(output_i.size()); \
+    vector<complex<T>> output(output_i.size()); \
+    vector<complex<T>> target(output.size()); \
+    for (unsigned i = 0; i < input_i.size(); i++) { \
+        input_i[i] = sin(2.0*M_PI*i*test.freq/rate) * (double) SCALE * ampl; \
+        input_q[i] = cos(2.0*M_PI*i*test.freq/rate) * (double) SCALE * ampl; \
+    } \
+    double nrate = rate * test.p / test.q; \
+    for (unsigned i = 0; i < target.size(); i++) \
+        target[i] = complex<double>(sin(2.0*M_PI*i*test.freq/nrate) * (double) SCALE * ampl, \
+                                    cos(2.0*M_PI*i*test.freq/nrate) * (double) SCALE * ampl); \
+    ComplexResampler<T> resampler(test.p, test.q, ntaps); \
+    resampler.resample(input_i, input_q, output_i, output_q); \
+    for (unsigned i = 0; i < output.size(); i++) \
+        output[i] = complex<T>(output_i[i], output_q[i]); \
+    test.rmse = complex_rmse(target, output, ntaps*test.p/test.q/2)/SCALE; \
+    test.pass = test.rmse < pass_limit; \
+}
+
+#define REAL_TEST(T, R, SCALE) \
 { \
     vector<T> input(test_sz/test.q * test.q); \
     vector<T> output(input.size() * test.p / test.q); \
@@ -71,11 +101,10 @@ static void print_test_result(test_case &test)
     double nrate = rate * test.p / test.q; \
     for (unsigned i = 0; i < target.size(); i++) \
         target[i] = sin(2.0*M_PI*i*test.freq/nrate) * (double) SCALE * ampl; \
-    RealResampler<T> resampler(test.p, test.q, ntaps); \
+    RealResampler<T, R> resampler(test.p, test.q, ntaps); \
     resampler.resample(input, output); \
     test.rmse = real_rmse(target, output, ntaps*test.p/test.q/2) / SCALE; \
     test.pass = test.rmse < pass_limit; \
-    print_test_result(test); \
 }
 
 static void run_test(test_case &test) 
@@ -99,18 +128,34 @@ static void run_test(test_case &test)
         return sqrt(error) / distance(b.begin()+offset, b.end());
     };
 
-    if      (test.type == "fc64") COMPLEX_TEST(double, 1.0)
-    else if (test.type == "fc32") COMPLEX_TEST(float, 1.0)
-    else if (test.type == "sc64") COMPLEX_TEST(long, numeric_limits<long>::max())
-    else if (test.type == "sc32") COMPLEX_TEST(int, numeric_limits<int>::max())
-    else if (test.type == "sc16") COMPLEX_TEST(short, numeric_limits<short>::max())
-    else if (test.type ==  "sc8") COMPLEX_TEST(char, numeric_limits<char>::max())
-    else if (test.type ==  "f64") REAL_TEST(double, 1.0)
-    else if (test.type ==  "f32") REAL_TEST(float, 1.0)
-    else if (test.type ==  "s64") REAL_TEST(long, numeric_limits<long>::max())
-    else if (test.type ==  "s32") REAL_TEST(int, numeric_limits<int>::max())
-    else if (test.type ==  "s16") REAL_TEST(short, numeric_limits<short>::max())
-    else if (test.type ==   "s8") REAL_TEST(char, numeric_limits<char>::max())
+    if (test.layout == "planar") {
+        if      (test.type == "fc64") PLANAR_TEST(double, 1.0)
+        else if (test.type == "fc32") PLANAR_TEST(float, 1.0)
+        else if (test.type == "sc64") PLANAR_TEST(long, numeric_limits<long>::max())
+        else if (test.type == "sc32") PLANAR_TEST(int, numeric_limits<int>::max())
+        else if (test.type == "sc16") PLANAR_TEST(short, numeric_limits<short>::max())
+        else if (test.type ==  "sc8") PLANAR_TEST(char, numeric_limits<char>::max())
+        return;
+    }
+
+    if (test.precision == "float") {
+        if      (test.type == "fc32") COMPLEX_TEST(float, Precision::Float, 1.0)
+        else if (test.type ==  "f32") REAL_TEST(float, Precision::Float, 1.0)
+        return;
+    }
+
+    if      (test.type == "fc64") COMPLEX_TEST(double, Precision::Double, 1.0)
+    else if (test.type == "fc32") COMPLEX_TEST(float, Precision::Double, 1.0)
+    else if (test.type == "sc64") COMPLEX_TEST(long, Precision::Double, numeric_limits<long>::max())
+    else if (test.type == "sc32") COMPLEX_TEST(int, Precision::Double, numeric_limits<int>::max())
+    else if (test.type == "sc16") COMPLEX_TEST(short, Precision::Double, numeric_limits<short>::max())
+    else if (test.type ==  "sc8") COMPLEX_TEST(char, Precision::Double, numeric_limits<char>::max())
+    else if (test.type ==  "f64") REAL_TEST(double, Precision::Double, 1.0)
+    else if (test.type ==  "f32") REAL_TEST(float, Precision::Double, 1.0)
+    else if (test.type ==  "s64") REAL_TEST(long, Precision::Double, numeric_limits<long>::max())
+    else if (test.type ==  "s32") REAL_TEST(int, Precision::Double, numeric_limits<int>::max())
+    else if (test.type ==  "s16") REAL_TEST(short, Precision::Double, numeric_limits<short>::max())
+    else if (test.type ==   "s8") REAL_TEST(char, Precision::Double, numeric_limits<char>::max())
 }
 
 static void print_final_results(int count, int pass)
@@ -123,22 +168,47 @@ int main(int argc, char **argv)
     vector<test_case> tests;
     int num = 0;
 
+    auto add_test = [&](double freq, string type, string precision, string layout, int p, int q) {
+        tests.push_back({
+            .num = num++,
+            .freq = freq,
+            .type = type,
+            .precision = precision,
+            .layout = layout,
+            .p = p,
+            .q = q,
+            .rmse = numeric_limits<double>::max(),
+            .pass = false,
+        });
+    };
+
     for (auto freq:freqs)
         for (auto type:types)
             for (auto p:pq)
                 for (auto q:pq)
-                    tests.push_back({
-                        .num = num++,
-                        .freq = freq,
-                        .type = type,
-                        .p = p,
-                        .q = q,
-                        .rmse = numeric_limits<double>::max(),
-                        .pass = false,
-                    });
+                    add_test(freq, type, "double", "interleaved", p, q);
+    for (auto freq:freqs)
+        for (auto type:float_types)
+            for (auto p:pq)
+                for (auto q:pq)
+                    add_test(freq, type, "float", "interleaved", p, q);
+    for (auto freq:freqs)
+        for (auto type:planar_types)
+            for (auto p:pq)
+                for (auto q:pq)
+                    add_test(freq, type, "double", "planar", p, q);
+    /*
+     * Cases run concurrently from a shared work queue and are reported in
+     * case order once all have completed
+     */
+    ThreadPool pool(max(thread::hardware_concurrency(), 1u));
+    pool.parallel(tests.size(), [&](size_t i, unsigned) {
+        run_test(tests[i]);
+    });
+
     int pass = 0;
     for (auto &test:tests) {
-        run_test(test);
+        print_test_result(test);
         pass += test.pass;
     }
     print_final_results(num, pass);